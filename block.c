@@ -1,6 +1,8 @@
 #include "block.h"
 #include "buffer.h"
 #include "hl.h"
+#include "col-index.h"
+#include "words.h"
 
 #define BLOCK_EDIT_SIZE 512
 
@@ -230,14 +232,51 @@ static long insert_bytes(const char *buf, long len)
 	return split_and_insert(buf, len);
 }
 
+/*
+ * Edits don't move the cursor, only blocks around it change. Returns
+ * offset of the cursor and sets view->cy.
+ */
+static long begin_edit(void)
+{
+	struct block_iter *bi = &view->cursor;
+	long offset, nl;
+
+	block_start_position(bi, &offset, &nl);
+	view->cy = nl + count_nl(bi->blk->data, bi->offset);
+	// the block may be freed
+	block_forget_anchor();
+	return offset + bi->offset;
+}
+
+static void end_edit(long offset)
+{
+	struct block_iter *bi = &view->cursor;
+
+	block_set_anchor(bi, offset - bi->offset, view->cy - count_nl(bi->blk->data, bi->offset));
+}
+
+static void fix_marks(long offset, long del, long ins)
+{
+	if (buffer->marks.count)
+		update_marks(buffer, offset, del, ins);
+}
+
 void do_insert(const char *buf, long len)
 {
-	long nl = insert_bytes(buf, len);
+	long offset, nl;
+
+	col_index_begin_edit(&view->cursor);
+	update_words(0, -1);
+	offset = begin_edit();
+	fix_marks(offset, 0, len);
+	nl = insert_bytes(buf, len);
 
 	buffer->nl += nl;
 	sanity_check();
 
-	update_cursor_y();
+	end_edit(offset);
+	col_index_end_edit(&view->cursor);
+	update_words(len, 1);
 	lines_changed(view->cy, nl ? INT_MAX : view->cy);
 	if (buffer->syn)
 		hl_insert(view->cy, nl);
@@ -255,10 +294,15 @@ char *do_delete(long len)
 	long offset = view->cursor.offset;
 	long pos = 0;
 	long deleted_nl = 0;
+	long cursor_offset;
 	char *buf;
 
 	if (!len)
 		return NULL;
+	col_index_begin_edit(&view->cursor);
+	update_words(len, -1);
+	cursor_offset = begin_edit();
+	fix_marks(cursor_offset, len, 0);
 
 	if (!offset) {
 		// the block where cursor is can become empty and thereby may be deleted
@@ -319,7 +363,9 @@ char *do_delete(long len)
 
 	sanity_check();
 
-	update_cursor_y();
+	end_edit(cursor_offset);
+	col_index_end_edit(&view->cursor);
+	update_words(0, 1);
 	lines_changed(view->cy, deleted_nl ? INT_MAX : view->cy);
 	if (buffer->syn)
 		hl_delete(view->cy, deleted_nl);
@@ -329,10 +375,11 @@ char *do_delete(long len)
 char *do_replace(long del, const char *buf, long ins)
 {
 	struct block *blk;
-	long offset, avail, new_size;
+	long offset, avail, new_size, cursor_offset;
 	char *ptr, *deleted;
 	long del_nl, ins_nl;
 
+	col_index_begin_edit(&view->cursor);
 	block_iter_normalize(&view->cursor);
 	blk = view->cursor.blk;
 	offset = view->cursor.offset;
@@ -356,6 +403,9 @@ char *do_replace(long del, const char *buf, long ins)
 	}
 
 	// modification is limited to one block
+	update_words(del, -1);
+	cursor_offset = begin_edit();
+	fix_marks(cursor_offset, del, ins);
 	ptr = blk->data + offset;
 	deleted = xmalloc(del);
 	del_nl = copy_count_nl(deleted, ptr, del);
@@ -372,7 +422,9 @@ char *do_replace(long del, const char *buf, long ins)
 
 	sanity_check();
 
-	update_cursor_y();
+	end_edit(cursor_offset);
+	col_index_end_edit(&view->cursor);
+	update_words(ins, 1);
 	if (del_nl == ins_nl) {
 		// some line(s) changed but lines after them did not move up or down
 		lines_changed(view->cy, view->cy + del_nl);
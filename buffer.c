@@ -17,6 +17,10 @@
 #include "unicode.h"
 #include "uchar.h"
 #include "detect.h"
+#include "journal.h"
+#include "follow.h"
+#include "undo-file.h"
+#include "words.h"
 
 struct buffer *buffer;
 bool everything_changed;
@@ -192,7 +196,14 @@ void free_buffer(struct buffer *b)
 
 	if (b->locked)
 		unlock_file(b->abs_filename);
-
+	if (b->loader)
+		cancel_loading(b);
+	unfollow_buffer(b);
+	unindex_buffer_words(b);
+	journal_discard(b);
+	save_undo_file(b);
+
+	block_forget_anchor();
 	item = b->blocks.next;
 	while (item != &b->blocks) {
 		struct list_head *next = item->next;
@@ -203,6 +214,7 @@ void free_buffer(struct buffer *b)
 		item = next;
 	}
 	free_changes(&b->change_head);
+	detach_marks(b);
 	free(b->line_start_states.ptrs);
 	free(b->views.ptrs);
 	free(b->display_filename);
@@ -418,4 +430,5 @@ void setup_buffer(void)
 	}
 	if (buffer->options.file_history && buffer->abs_filename)
 		restore_cursor_from_history();
+	journal_replay();
 }
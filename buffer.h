@@ -6,10 +6,23 @@
 #include "options.h"
 #include "common.h"
 #include "ptr-array.h"
+#include "mark.h"
+
+struct journal;
+struct file_loader;
+
+// one edit of a change chain
+struct change_edit {
+	long offset;
+	long del_count;
+	long ins_count;
+};
 
 struct change {
 	struct change *next;
+	// newer changes, points to prev1 if there is only one
 	struct change **prev;
+	struct change *prev1;
 	unsigned int nr_prev;
 
 	// move after inserted text when undoing delete?
@@ -21,16 +34,28 @@ struct change {
 
 	// deleted bytes (inserted bytes need not to be saved)
 	char *buf;
+	// size of buf if it is compressed, 0 otherwise
+	long compressed_size;
+
+	// edits of a change chain in the order they are applied, counts
+	// above are totals and buf holds deleted bytes of every edit
+	struct change_edit *edits;
+	long nr_edits;
 };
 
 struct buffer {
 	struct list_head blocks;
 	struct change change_head;
 	struct change *cur_change;
+	// bytes used by undo history, see change.c
+	long undo_size;
 
 	// used to determine if buffer is modified
 	struct change *saved_change;
 
+	// history from the undo file has been looked for, see undo-file.c
+	bool undo_file_loaded;
+
 	struct stat st;
 
 	// needed for identifying buffers whose filename is NULL
@@ -41,6 +66,11 @@ struct buffer {
 	// views pointing to this buffer
 	struct ptr_array views;
 
+	// struct mark pointers sorted by offset, see mark.c
+	struct ptr_array marks;
+	// shifts of marks not yet applied to their offsets
+	long *mark_deltas;
+
 	char *display_filename;
 	char *abs_filename;
 
@@ -48,6 +78,9 @@ struct buffer {
 	bool locked;
 	bool setup;
 
+	// loading was cancelled, buffer contains only part of the file
+	bool partial;
+
 	enum newline_sequence newline;
 
 	// Encoding of the file. Buffer always contains UTF-8.
@@ -62,6 +95,24 @@ struct buffer {
 
 	int changed_line_min;
 	int changed_line_max;
+
+	// unsaved changes, see journal.c
+	struct journal *journal;
+	// journal is replayed when loading has finished and the buffer is
+	// current
+	bool journal_pending;
+
+	// non-NULL while the file is being loaded, see load_more()
+	struct file_loader *loader;
+
+	// inotify watch and size of the file already in buffer, see follow.c
+	int follow_wd;
+	// directory watch while waiting for a rotated file to be created
+	int follow_dir_wd;
+	off_t follow_offset;
+
+	// words are counted in the completion index, see words.c
+	bool words_indexed;
 };
 
 enum selection {
@@ -99,12 +150,12 @@ struct view {
 	enum selection selection;
 
 	// cursor offset when selection was started
-	long sel_so;
+	struct mark sel_so;
 
-	// If sel_eo is UINT_MAX that means the offset must be calculated from
-	// the cursor iterator.  Otherwise the offset is precalculated and may
-	// not be same as cursor position (see search/replace code).
-	long sel_eo;
+	// If sel_eo is not added to the buffer the offset must be calculated
+	// from the cursor iterator.  Otherwise the offset is precalculated and
+	// may not be same as cursor position (see search/replace code).
+	struct mark sel_eo;
 
 	// center view to cursor if scrolled
 	bool center_on_scroll;
@@ -115,7 +166,7 @@ struct view {
 	// These are used to save cursor state when there are multiple views
 	// sharing same buffer.
 	bool restore_cursor;
-	long saved_cursor_offset;
+	struct mark saved_cursor;
 };
 
 // buffer = view->buffer = window->view->buffer
@@ -139,6 +190,12 @@ static inline bool buffer_modified(struct buffer *b)
 	return b->saved_change != b->cur_change;
 }
 
+// file is not completely loaded, editing and saving is not allowed
+static inline bool buffer_incomplete(struct buffer *b)
+{
+	return b->loader || b->partial;
+}
+
 static inline bool selecting(void)
 {
 	return !!view->selection;
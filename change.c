@@ -2,54 +2,287 @@
 #include "buffer.h"
 #include "error.h"
 #include "block.h"
+#include "journal.h"
+#include "lz.h"
+#include "undo-file.h"
 
 static enum change_merge change_merge;
 static enum change_merge prev_change_merge;
 
-static struct change *alloc_change(void)
+/*
+ * All edits of a change chain are recorded to one change, see
+ * record_chain_edit(). This doesn't need to be local to buffer because
+ * commands are atomic.
+ */
+static bool in_change_chain;
+static struct change *chain_change;
+
+/*
+ * Undo history of a buffer is limited to options.undo_limit MiB. Deleted
+ * text of changes which can't be merged into anymore is compressed and
+ * when the limit is exceeded changes which are least likely to be undone
+ * are forgotten.
+ */
+
+// compressing smaller payloads isn't worth it
+#define MIN_COMPRESS_SIZE 256
+
+#define CHANGES_PER_SLAB 64
+
+// unused changes linked by next pointer
+static struct change *change_pool;
+
+struct change *alloc_change(void)
+{
+	struct change *change;
+
+	if (!change_pool) {
+		struct change *slab = xnew(struct change, CHANGES_PER_SLAB);
+		int i;
+
+		for (i = 0; i < CHANGES_PER_SLAB; i++) {
+			slab[i].next = change_pool;
+			change_pool = &slab[i];
+		}
+	}
+	change = change_pool;
+	change_pool = change->next;
+	clear(change);
+	return change;
+}
+
+static void free_prev(struct change *change)
+{
+	// array is allocated only if there are two or more newer changes
+	if (change->prev != &change->prev1)
+		free(change->prev);
+}
+
+static void release_change(struct change *change)
+{
+	free(change->buf);
+	free(change->edits);
+	free_prev(change);
+	change->next = change_pool;
+	change_pool = change;
+}
+
+static long change_memory(const struct change *change)
+{
+	long size = sizeof(*change);
+
+	if (change->nr_prev > 1)
+		size += change->nr_prev * sizeof(change->prev[0]);
+	size += change->nr_edits * sizeof(change->edits[0]);
+	if (change->buf)
+		size += change->compressed_size ? change->compressed_size : change->del_count;
+	return size;
+}
+
+static void add_prev(struct change *change, struct change *prev)
+{
+	if (!change->nr_prev) {
+		change->prev = &change->prev1;
+	} else if (change->prev == &change->prev1) {
+		change->prev = xnew(struct change *, 2);
+		change->prev[0] = change->prev1;
+	} else {
+		xrenew(change->prev, change->nr_prev + 1);
+	}
+	change->prev[change->nr_prev++] = prev;
+}
+
+static void remove_prev(struct change *change, struct change *prev)
+{
+	unsigned int i;
+
+	for (i = 0; change->prev[i] != prev; i++)
+		;
+	change->nr_prev--;
+	memmove(change->prev + i, change->prev + i + 1, (change->nr_prev - i) * sizeof(change->prev[0]));
+	if (change->nr_prev == 1 && change->prev != &change->prev1) {
+		change->prev1 = change->prev[0];
+		free(change->prev);
+		change->prev = &change->prev1;
+	} else if (!change->nr_prev) {
+		change->prev = NULL;
+	}
+}
+
+static void compress_change(struct change *change)
+{
+	long size, len = change->del_count;
+	char *buf;
+
+	if (!change->buf || change->compressed_size || len < MIN_COMPRESS_SIZE)
+		return;
+
+	buf = xmalloc(lz_bound(len));
+	size = lz_compress(change->buf, len, buf);
+	if (size > len - len / 8) {
+		// incompressible
+		free(buf);
+		return;
+	}
+	buffer->undo_size -= change_memory(change);
+	free(change->buf);
+	change->buf = buf;
+	xrenew(change->buf, size);
+	change->compressed_size = size;
+	buffer->undo_size += change_memory(change);
+}
+
+// fails only if text read from an undo file is corrupted
+static bool decompress_change(struct change *change)
 {
-	return xcalloc(sizeof(struct change));
+	char *buf;
+
+	if (!change->compressed_size)
+		return true;
+
+	buf = xmalloc(change->del_count);
+	if (!lz_decompress(change->buf, change->compressed_size, buf, change->del_count)) {
+		free(buf);
+		return false;
+	}
+	buffer->undo_size -= change_memory(change);
+	free(change->buf);
+	change->buf = buf;
+	change->compressed_size = 0;
+	buffer->undo_size += change_memory(change);
+	return true;
 }
 
 static void add_change(struct change *change)
 {
 	struct change *head = buffer->cur_change;
 
+	// nothing is merged into head anymore
+	compress_change(head);
+
+	buffer->undo_size -= change_memory(head);
 	change->next = head;
-	xrenew(head->prev, head->nr_prev + 1);
-	head->prev[head->nr_prev++] = change;
+	add_prev(head, change);
+	buffer->undo_size += change_memory(head) + change_memory(change);
 
 	buffer->cur_change = change;
 }
 
-/* This doesn't need to be local to buffer because commands are atomic. */
-static struct change *change_barrier;
+// walk change and all changes after it
+static void collect_changes(struct change *change, struct ptr_array *changes)
+{
+	long i = changes->count;
+
+	ptr_array_add(changes, change);
+	for (; i < changes->count; i++) {
+		struct change *c = changes->ptrs[i];
+		unsigned int j;
 
-static bool is_change_chain_barrier(struct change *change)
+		for (j = 0; j < c->nr_prev; j++)
+			ptr_array_add(changes, c->prev[j]);
+	}
+}
+
+// free a branch of changes which is no longer linked to the tree
+static void free_branch(struct change *change)
 {
-	return !change->ins_count && !change->del_count;
+	PTR_ARRAY(changes);
+	long i;
+
+	collect_changes(change, &changes);
+	for (i = 0; i < changes.count; i++) {
+		struct change *c = changes.ptrs[i];
+
+		buffer->undo_size -= change_memory(c);
+		if (buffer->saved_change == c)
+			buffer->saved_change = NULL;
+		release_change(c);
+	}
+	free(changes.ptrs);
+}
+
+/*
+ * Replace the oldest change with the change head so that the head
+ * represents the buffer after it.
+ */
+static void forget_oldest_change(struct change *oldest)
+{
+	struct change *head = &buffer->change_head;
+	unsigned int i;
+
+	if (buffer->saved_change == head)
+		buffer->saved_change = NULL;
+	if (buffer->saved_change == oldest)
+		buffer->saved_change = head;
+	if (buffer->cur_change == oldest)
+		buffer->cur_change = head;
+
+	buffer->undo_size -= change_memory(head);
+	free_prev(head);
+	head->nr_prev = oldest->nr_prev;
+	if (oldest->prev == &oldest->prev1) {
+		head->prev1 = oldest->prev1;
+		head->prev = &head->prev1;
+	} else {
+		head->prev = oldest->prev;
+	}
+	for (i = 0; i < head->nr_prev; i++)
+		head->prev[i]->next = head;
+	buffer->undo_size += change_memory(head);
+
+	buffer->undo_size -= change_memory(oldest);
+	// prev array now belongs to head
+	oldest->prev = NULL;
+	release_change(oldest);
+}
+
+static void limit_undo_memory(void)
+{
+	long limit = options.undo_limit * 1024L * 1024L;
+	long target = limit / 4 * 3;
+	PTR_ARRAY(path);
+	struct change *c;
+	long i, n;
+
+	if (buffer->undo_size <= limit)
+		return;
+
+	// changes from the current one to the change head
+	for (c = buffer->cur_change; c; c = c->next)
+		ptr_array_add(&path, c);
+	n = path.count;
+#define PATH(i) ((struct change *)path.ptrs[n - 1 - (i)])
+
+	// first forget undone changes which were replaced by newer changes,
+	// oldest first
+	for (i = 0; i < n - 1 && buffer->undo_size > target; i++) {
+		struct change *node = PATH(i);
+		struct change *keep = PATH(i + 1);
+
+		while (node->nr_prev > 1 && buffer->undo_size > target) {
+			struct change *branch = node->prev[0] == keep ? node->prev[1] : node->prev[0];
+
+			buffer->undo_size -= change_memory(node);
+			remove_prev(node, branch);
+			buffer->undo_size += change_memory(node);
+			free_branch(branch);
+		}
+	}
+
+	// then oldest changes; changes which can be redone are kept
+	for (i = 1; i < n && buffer->undo_size > target; i++)
+		forget_oldest_change(PATH(i));
+#undef PATH
+	free(path.ptrs);
 }
 
 static struct change *new_change(void)
 {
-	struct change *change;
+	struct change *change = alloc_change();
 
-	if (change_barrier) {
-		/*
-		 * We are recording series of changes (:replace for example)
-		 * and now we have just made the first change so we have to
-		 * mark beginning of the chain.
-		 *
-		 * We could have done this before when starting the change
-		 * chain but then we may have ended up with an empty chain.
-		 * We don't want to record empty changes ever.
-		 */
-		add_change(change_barrier);
-		change_barrier = NULL;
-	}
-
-	change = alloc_change();
 	add_change(change);
+	if (!in_change_chain)
+		limit_undo_memory();
 	return change;
 }
 
@@ -58,12 +291,72 @@ static long buffer_offset(void)
 	return block_iter_get_offset(&view->cursor);
 }
 
+// buf of a chain change grows in powers of two
+static long chain_buf_size(long size)
+{
+	long alloc = 64;
+
+	while (alloc < size)
+		alloc *= 2;
+	return alloc;
+}
+
+/*
+ * Edits of a change chain (:replace for example) are appended to one
+ * change instead of allocating a change for each of them. The change is
+ * added to the tree on the first edit so empty chains are never recorded.
+ */
+static void record_chain_edit(char *deleted, long del_count, long ins_count)
+{
+	struct change *change = chain_change;
+	long offset = buffer_offset();
+	struct change_edit *e;
+
+	if (!change) {
+		change = new_change();
+		change->offset = offset;
+		chain_change = change;
+	}
+
+	buffer->undo_size -= change_memory(change);
+	e = change->nr_edits ? &change->edits[change->nr_edits - 1] : NULL;
+	if (e && !del_count && !e->del_count && offset == e->offset + e->ins_count) {
+		// pasted text is inserted in chunks
+		e->ins_count += ins_count;
+	} else {
+		long n = change->nr_edits;
+
+		if (!(n & (n - 1)))
+			xrenew(change->edits, n ? n * 2 : 1);
+		e = &change->edits[change->nr_edits++];
+		e->offset = offset;
+		e->del_count = del_count;
+		e->ins_count = ins_count;
+	}
+	if (del_count) {
+		long size = change->del_count + del_count;
+
+		if (!change->buf || chain_buf_size(change->del_count) < size)
+			xrenew(change->buf, chain_buf_size(size));
+		memcpy(change->buf + change->del_count, deleted, del_count);
+		change->del_count = size;
+		free(deleted);
+	}
+	change->ins_count += ins_count;
+	buffer->undo_size += change_memory(change);
+}
+
 static void record_insert(long len)
 {
 	struct change *change = buffer->cur_change;
 
 	BUG_ON(!len);
-	if (change_merge == prev_change_merge && change_merge == CHANGE_MERGE_INSERT) {
+	if (in_change_chain) {
+		record_chain_edit(NULL, 0, len);
+		return;
+	}
+	if (change_merge == prev_change_merge && change_merge == CHANGE_MERGE_INSERT &&
+	    !change->nr_edits) {
 		BUG_ON(change->del_count);
 		change->ins_count += len;
 		return;
@@ -80,21 +373,30 @@ static void record_delete(char *buf, long len, bool move_after)
 
 	BUG_ON(!len);
 	BUG_ON(!buf);
-	if (change_merge == prev_change_merge) {
+	if (in_change_chain) {
+		// only the whole chain can be undone so move_after doesn't matter
+		record_chain_edit(buf, len, 0);
+		return;
+	}
+	if (change_merge == prev_change_merge && !change->nr_edits && decompress_change(change)) {
 		if (change_merge == CHANGE_MERGE_DELETE) {
+			buffer->undo_size -= change_memory(change);
 			xrenew(change->buf, change->del_count + len);
 			memcpy(change->buf + change->del_count, buf, len);
 			change->del_count += len;
+			buffer->undo_size += change_memory(change);
 			free(buf);
 			return;
 		}
 		if (change_merge == CHANGE_MERGE_ERASE) {
+			buffer->undo_size -= change_memory(change);
 			xrenew(buf, len + change->del_count);
 			memcpy(buf + len, change->buf, change->del_count);
 			change->del_count += len;
 			free(change->buf);
 			change->buf = buf;
 			change->offset -= len;
+			buffer->undo_size += change_memory(change);
 			return;
 		}
 	}
@@ -104,6 +406,7 @@ static void record_delete(char *buf, long len, bool move_after)
 	change->del_count = len;
 	change->move_after = move_after;
 	change->buf = buf;
+	buffer->undo_size += len;
 }
 
 static void record_replace(char *deleted, long del_count, long ins_count)
@@ -114,11 +417,16 @@ static void record_replace(char *deleted, long del_count, long ins_count)
 	BUG_ON(!del_count && deleted);
 	BUG_ON(!del_count && !ins_count);
 
+	if (in_change_chain) {
+		record_chain_edit(deleted, del_count, ins_count);
+		return;
+	}
 	change = new_change();
 	change->offset = buffer_offset();
 	change->ins_count = ins_count;
 	change->del_count = del_count;
 	change->buf = deleted;
+	buffer->undo_size += del_count;
 }
 
 void begin_change(enum change_merge m)
@@ -133,55 +441,102 @@ void end_change(void)
 
 void begin_change_chain(void)
 {
-	BUG_ON(change_barrier);
+	BUG_ON(in_change_chain);
 
-	/*
-	 * Allocate change chain barrier but add it to the change tree only if
-	 * there will be any real changes
-	 */
-	change_barrier = alloc_change();
 	change_merge = CHANGE_MERGE_NONE;
+	in_change_chain = true;
+	chain_change = NULL;
 }
 
 void end_change_chain(void)
 {
-	if (change_barrier) {
-		/* There were no changes in this change chain. */
-		free(change_barrier);
-		change_barrier = NULL;
-	} else {
-		/* There were some changes. Add end of chain marker. */
-		add_change(alloc_change());
+	in_change_chain = false;
+	if (chain_change) {
+		chain_change = NULL;
+		limit_undo_memory();
 	}
 }
 
-static void fix_cursors(long offset, long del, long ins)
+// move cursor relative to its previous position instead of seeking
+static void move_to_edit(long *pos, long offset)
 {
-	int i;
-
-	for (i = 0; i < buffer->views.count; i++) {
-		struct view *v = buffer->views.ptrs[i];
+	if (*pos < 0)
+		block_iter_goto_offset(&view->cursor, offset);
+	else if (offset < *pos)
+		block_iter_back_bytes(&view->cursor, *pos - offset);
+	else
+		block_iter_skip_bytes(&view->cursor, offset - *pos);
+	*pos = offset;
+}
 
-		if (v != view && offset < v->saved_cursor_offset) {
-			if (offset + del <= v->saved_cursor_offset) {
-				v->saved_cursor_offset -= del;
-				v->saved_cursor_offset += ins;
-			} else {
-				v->saved_cursor_offset = offset;
-			}
+/*
+ * Edits are reversed in reverse order in one pass over the buffer. The
+ * reversed edits are stored in the order they were applied so that
+ * reversing them again redoes the chain.
+ */
+static void reverse_chain(struct change *change)
+{
+	long n = change->nr_edits;
+	struct change_edit *edits = xnew(struct change_edit, n);
+	char *old = change->buf;
+	char *buf = change->ins_count ? xmalloc(change->ins_count) : NULL;
+	long i, len = 0, pos = -1;
+	long end = change->del_count;
+
+	buffer->undo_size -= change_memory(change);
+	for (i = 0; i < n; i++) {
+		const struct change_edit *e = &change->edits[n - 1 - i];
+		const char *inserted = NULL;
+		char *deleted = NULL;
+
+		if (e->del_count) {
+			end -= e->del_count;
+			inserted = old + end;
+		}
+		move_to_edit(&pos, e->offset);
+		if (!e->ins_count) {
+			do_insert(inserted, e->del_count);
+		} else if (e->del_count) {
+			deleted = do_replace(e->ins_count, inserted, e->del_count);
+		} else {
+			deleted = do_delete(e->ins_count);
+		}
+		journal_record(e->offset, deleted, e->ins_count, inserted, e->del_count);
+		if (deleted) {
+			memcpy(buf + len, deleted, e->ins_count);
+			len += e->ins_count;
+			free(deleted);
 		}
+		edits[i].offset = e->offset;
+		edits[i].del_count = e->ins_count;
+		edits[i].ins_count = e->del_count;
 	}
+	free(change->edits);
+	change->edits = edits;
+	free(change->buf);
+	change->buf = buf;
+	change->ins_count = change->del_count;
+	change->del_count = len;
+	buffer->undo_size += change_memory(change);
+	compress_change(change);
 }
 
-static void reverse_change(struct change *change)
+// fails only if text read from an undo file is corrupted
+static bool reverse_change(struct change *change)
 {
-	if (buffer->views.count > 1)
-		fix_cursors(change->offset, change->ins_count, change->del_count);
+	if (!decompress_change(change))
+		return false;
+	if (change->nr_edits) {
+		reverse_chain(change);
+		return true;
+	}
 
+	buffer->undo_size -= change_memory(change);
 	block_iter_goto_offset(&view->cursor, change->offset);
 	if (!change->ins_count) {
 		// convert delete to insert
 		do_insert(change->buf, change->del_count);
+		journal_record(change->offset, NULL, 0, change->buf, change->del_count);
 		if (change->move_after)
 			block_iter_skip_bytes(&view->cursor, change->del_count);
 		change->ins_count = change->del_count;
@@ -194,6 +549,7 @@ static void reverse_change(struct change *change)
 		long ins_count = change->del_count;
 		char *buf = do_replace(del_count, change->buf, ins_count);
 
+		journal_record(change->offset, buf, del_count, change->buf, ins_count);
 		free(change->buf);
 		change->buf = buf;
 		change->ins_count = ins_count;
@@ -201,9 +557,65 @@ static void reverse_change(struct change *change)
 	} else {
 		// convert insert to delete
 		change->buf = do_delete(change->ins_count);
+		journal_record(change->offset, change->buf, change->ins_count, NULL, 0);
 		change->del_count = change->ins_count;
 		change->ins_count = 0;
 	}
+	buffer->undo_size += change_memory(change);
+	compress_change(change);
+	return true;
+}
+
+/*
+ * Attach history read from the undo file above the change head. Changes
+ * made since the file was opened continue from the change which matches
+ * the file.
+ */
+static void load_undo_history(void)
+{
+	struct change *head = &buffer->change_head;
+	struct change *root, *cur;
+	PTR_ARRAY(changes);
+	unsigned int i;
+
+	buffer->undo_file_loaded = true;
+	if (!buffer->abs_filename || buffer_incomplete(buffer))
+		return;
+	root = read_undo_file(&cur);
+	if (!root)
+		return;
+
+	for (i = 0; i < head->nr_prev; i++) {
+		head->prev[i]->next = cur;
+		add_prev(cur, head->prev[i]);
+	}
+	free_prev(head);
+	head->nr_prev = root->nr_prev;
+	if (root->prev == &root->prev1) {
+		head->prev1 = root->prev1;
+		head->prev = &head->prev1;
+	} else {
+		head->prev = root->prev;
+	}
+	for (i = 0; i < head->nr_prev; i++)
+		head->prev[i]->next = head;
+	root->prev = NULL;
+	release_change(root);
+	if (cur == root)
+		cur = head;
+
+	if (buffer->saved_change == head)
+		buffer->saved_change = cur;
+	buffer->cur_change = cur;
+
+	// head itself is part of struct buffer
+	buffer->undo_size = change_memory(head) - sizeof(*head);
+	for (i = 0; i < head->nr_prev; i++)
+		collect_changes(head->prev[i], &changes);
+	for (i = 0; i < changes.count; i++)
+		buffer->undo_size += change_memory(changes.ptrs[i]);
+	free(changes.ptrs);
+	limit_undo_memory();
 }
 
 bool undo(void)
@@ -211,24 +623,18 @@ bool undo(void)
 	struct change *change = buffer->cur_change;
 
 	reset_preferred_x();
+	if (!change->next && !buffer->undo_file_loaded) {
+		load_undo_history();
+		change = buffer->cur_change;
+	}
 	if (!change->next)
 		return false;
-
-	if (is_change_chain_barrier(change)) {
-		int count = 0;
-
-		while (1) {
-			change = change->next;
-			if (is_change_chain_barrier(change))
-				break;
-			reverse_change(change);
-			count++;
-		}
-		if (count > 1)
-			info_msg("Undid %d changes.", count);
-	} else {
-		reverse_change(change);
+	if (!reverse_change(change)) {
+		error_msg("Undo history is corrupted.");
+		return false;
 	}
+	if (change->nr_edits > 1)
+		info_msg("Undid %ld changes.", change->nr_edits);
 	buffer->cur_change = change->next;
 	return true;
 }
@@ -238,6 +644,10 @@ bool redo(unsigned int change_id)
 	struct change *change = buffer->cur_change;
 
 	reset_preferred_x();
+	if (!change->next && !buffer->undo_file_loaded) {
+		load_undo_history();
+		change = buffer->cur_change;
+	}
 	if (!change->prev) {
 		/* don't complain if change_id is 0 */
 		if (change_id)
@@ -258,66 +668,103 @@ bool redo(unsigned int change_id)
 	}
 
 	change = change->prev[change_id];
-	if (is_change_chain_barrier(change)) {
-		int count = 0;
-
-		while (1) {
-			change = change->prev[change->nr_prev - 1];
-			if (is_change_chain_barrier(change))
-				break;
-			reverse_change(change);
-			count++;
-		}
-		if (count > 1)
-			info_msg("Redid %d changes.", count);
-	} else {
-		reverse_change(change);
+	if (!reverse_change(change)) {
+		error_msg("Undo history is corrupted.");
+		return false;
 	}
+	if (change->nr_edits > 1)
+		info_msg("Redid %ld changes.", change->nr_edits);
 	buffer->cur_change = change;
 	return true;
 }
 
-void free_changes(struct change *ch)
+void undo_stats(struct undo_stats *stats)
 {
-top:
-	while (ch->nr_prev)
-		ch = ch->prev[ch->nr_prev - 1];
-
-	// ch is leaf now
-	while (ch->next) {
-		struct change *next = ch->next;
+	PTR_ARRAY(changes);
+	struct change *head = &buffer->change_head;
+	long i;
+
+	clear(stats);
+	for (i = 0; i < head->nr_prev; i++)
+		collect_changes(head->prev[i], &changes);
+	for (i = 0; i < changes.count; i++) {
+		struct change *c = changes.ptrs[i];
+
+		if (c->buf) {
+			stats->text += c->del_count;
+			stats->stored_text += c->compressed_size ? c->compressed_size : c->del_count;
+		}
+	}
+	stats->changes = changes.count;
+	stats->memory = buffer->undo_size;
+	free(changes.ptrs);
+}
 
-		free(ch->buf);
-		free(ch);
+// free all changes after head
+void free_changes(struct change *head)
+{
+	PTR_ARRAY(changes);
+	long i;
+
+	for (i = 0; i < head->nr_prev; i++)
+		collect_changes(head->prev[i], &changes);
+	for (i = 0; i < changes.count; i++)
+		release_change(changes.ptrs[i]);
+	free(changes.ptrs);
+	free_prev(head);
+}
 
-		ch = next;
-		if (--ch->nr_prev)
-			goto top;
+// buffer contents were replaced without recording a change, see follow.c
+void forget_changes(struct buffer *b)
+{
+	free_changes(&b->change_head);
+	b->change_head.prev = NULL;
+	b->change_head.nr_prev = 0;
+	b->cur_change = &b->change_head;
+	b->saved_change = &b->change_head;
+	b->undo_size = 0;
+}
 
-		// we have become leaf
-		free(ch->prev);
+static bool can_edit(void)
+{
+	if (buffer_incomplete(buffer)) {
+		error_msg("File is not completely loaded.");
+		return false;
+	}
+	if (!buffer->undo_file_loaded) {
+		// the history can be checked only against unchanged contents
+		// and must be merged before the buffer is closed and saved
+		load_undo_history();
+		// don't merge the first edit into a change from the file
+		prev_change_merge = CHANGE_MERGE_NONE;
 	}
+	return true;
 }
 
-void buffer_insert_bytes(const char *buf, long len)
+// returns false if the buffer can't be edited
+bool buffer_insert_bytes(const char *buf, long len)
 {
 	long rec_len = len;
+	long offset;
 
 	reset_preferred_x();
 	if (len == 0)
-		return;
+		return true;
+	if (!can_edit())
+		return false;
 
+	offset = block_iter_get_offset(&view->cursor);
 	if (buf[len - 1] != '\n' && block_iter_is_eof(&view->cursor)) {
 		// force newline at EOF
 		do_insert("\n", 1);
+		journal_record(offset, NULL, 0, "\n", 1);
 		rec_len++;
 	}
 
 	do_insert(buf, len);
+	journal_record(offset, NULL, 0, buf, len);
 	record_insert(rec_len);
-
-	if (buffer->views.count > 1)
-		fix_cursors(block_iter_get_offset(&view->cursor), len, 0);
+	return true;
 }
 
 static bool would_delete_last_bytes(long count)
@@ -342,8 +789,10 @@ static bool would_delete_last_bytes(long count)
 
 static void buffer_delete_bytes_internal(long len, bool move_after)
 {
+	char *deleted;
+
 	reset_preferred_x();
-	if (len == 0)
+	if (len == 0 || !can_edit())
 		return;
 
 	// check if all newlines from EOF would be deleted
@@ -359,10 +808,9 @@ static void buffer_delete_bytes_internal(long len, bool move_after)
 			}
 		}
 	}
-	record_delete(do_delete(len), len, move_after);
-
-	if (buffer->views.count > 1)
-		fix_cursors(block_iter_get_offset(&view->cursor), len, 0);
+	deleted = do_delete(len);
+	journal_record(block_iter_get_offset(&view->cursor), deleted, len, NULL, 0);
+	record_delete(deleted, len, move_after);
 }
 
 void buffer_delete_bytes(long len)
@@ -375,34 +823,32 @@ void buffer_erase_bytes(long len)
 	buffer_delete_bytes_internal(len, true);
 }
 
-void buffer_replace_bytes(long del_count, const char *inserted, long ins_count)
+// returns false if the buffer can't be edited
+bool buffer_replace_bytes(long del_count, const char *inserted, long ins_count)
 {
 	char *deleted = NULL;
 
 	reset_preferred_x();
-	if (del_count == 0) {
-		buffer_insert_bytes(inserted, ins_count);
-		return;
-	}
+	if (!can_edit())
+		return false;
+	if (del_count == 0)
+		return buffer_insert_bytes(inserted, ins_count);
 	if (ins_count == 0) {
 		buffer_delete_bytes(del_count);
-		return;
+		return true;
 	}
 
 	// check if all newlines from EOF would be deleted
 	if (would_delete_last_bytes(del_count)) {
 		if (inserted[ins_count - 1] != '\n') {
 			// don't replace last newline
-			if (--del_count == 0) {
-				buffer_insert_bytes(inserted, ins_count);
-				return;
-			}
+			if (--del_count == 0)
+				return buffer_insert_bytes(inserted, ins_count);
 		}
 	}
 
 	deleted = do_replace(del_count, inserted, ins_count);
+	journal_record(block_iter_get_offset(&view->cursor), deleted, del_count, inserted, ins_count);
 	record_replace(deleted, del_count, ins_count);
-
-	if (buffer->views.count > 1)
-		fix_cursors(block_iter_get_offset(&view->cursor), del_count, ins_count);
+	return true;
 }
@@ -11,7 +11,17 @@ enum change_merge {
 };
 
 struct change;
+struct buffer;
 
+struct undo_stats {
+	long changes;
+	long memory;
+	// deleted text and how much memory it uses after compression
+	long text;
+	long stored_text;
+};
+
+struct change *alloc_change(void);
 void begin_change(enum change_merge m);
 void end_change(void);
 void begin_change_chain(void);
@@ -19,9 +29,11 @@ void end_change_chain(void);
 bool undo(void);
 bool redo(unsigned int change_id);
 void free_changes(struct change *head);
-void buffer_insert_bytes(const char *buf, long len);
+void forget_changes(struct buffer *b);
+void undo_stats(struct undo_stats *stats);
+bool buffer_insert_bytes(const char *buf, long len);
 void buffer_delete_bytes(long len);
 void buffer_erase_bytes(long len);
-void buffer_replace_bytes(long del_count, const char *inserted, long ins_count);
+bool buffer_replace_bytes(long del_count, const char *inserted, long ins_count);
 
 #endif
@@ -0,0 +1,253 @@
+#include "col-index.h"
+#include "buffer.h"
+#include "iter.h"
+#include "uchar.h"
+
+/*
+ * Finding display column of a byte offset or byte offset of a display
+ * column requires scanning from beginning of the line. That is too slow
+ * for lines which are megabytes long (minified JavaScript etc.) so for
+ * long lines column of every CHECKPOINT_CHARS'th character is remembered.
+ *
+ * Checkpoints are added lazily only as far as needed. Lines are identified
+ * by their address. An edit can move any line of the block it changes so
+ * indexes of other lines of the buffer are dropped. The edited line gets
+ * its new address and keeps checkpoints up to the edited byte, which keeps
+ * typing in a long line fast.
+ */
+
+#define MIN_LINE_SIZE (16 * 1024)
+#define CHECKPOINT_CHARS 1024
+#define NR_ENTRIES 16
+
+struct col_index {
+	const unsigned char *line;
+	int buffer_id;
+	unsigned int tab_width;
+	bool ctrl_tabs;
+
+	// checkpoints[i] is position of character i * CHECKPOINT_CHARS
+	struct col_pos *checkpoints;
+	long count;
+	long alloc;
+
+	// no checkpoints after the last one
+	bool complete;
+};
+
+static struct col_index entries[NR_ENTRIES];
+static int next_entry;
+
+// line containing the cursor while it is being edited
+static struct col_index *edited;
+static long edited_pos;
+
+static unsigned int char_width(unsigned int u, unsigned int col, unsigned int tw, bool ctrl_tabs)
+{
+	if (likely(u < 0x80)) {
+		if (!u_is_ctrl(u))
+			return 1;
+		if (u == '\t' && !ctrl_tabs)
+			return (col + tw) / tw * tw - col;
+		return 2;
+	}
+	return u_char_width(u);
+}
+
+static struct col_index *get_index(const unsigned char *line, bool ctrl_tabs)
+{
+	unsigned int tw = buffer->options.tab_width;
+	struct col_index *ci;
+	int i;
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		ci = &entries[i];
+		if (ci->line == line && ci->buffer_id == buffer->id &&
+		    ci->tab_width == tw && ci->ctrl_tabs == ctrl_tabs)
+			return ci;
+	}
+
+	ci = &entries[next_entry];
+	next_entry = (next_entry + 1) % NR_ENTRIES;
+	ci->line = line;
+	ci->buffer_id = buffer->id;
+	ci->tab_width = tw;
+	ci->ctrl_tabs = ctrl_tabs;
+	ci->count = 0;
+	ci->complete = false;
+	if (!ci->alloc) {
+		ci->alloc = 64;
+		ci->checkpoints = xnew(struct col_pos, ci->alloc);
+	}
+	clear(&ci->checkpoints[0]);
+	ci->count = 1;
+	return ci;
+}
+
+// add checkpoints until the last one is after offset or col
+static void extend(struct col_index *ci, long size, long offset, unsigned int col)
+{
+	struct col_pos pos = ci->checkpoints[ci->count - 1];
+
+	while (!ci->complete && pos.offset <= offset && pos.col <= col) {
+		long n = CHECKPOINT_CHARS;
+
+		while (n && pos.offset < size) {
+			unsigned int u = ci->line[pos.offset];
+
+			if (u < 0x80)
+				pos.offset++;
+			else
+				u = u_get_nonascii(ci->line, size, &pos.offset);
+			pos.col += char_width(u, pos.col, ci->tab_width, ci->ctrl_tabs);
+			pos.chars++;
+			n--;
+		}
+		if (n) {
+			ci->complete = true;
+			break;
+		}
+		if (ci->count == ci->alloc) {
+			ci->alloc *= 2;
+			xrenew(ci->checkpoints, ci->alloc);
+		}
+		ci->checkpoints[ci->count++] = pos;
+	}
+}
+
+static long line_length(const unsigned char *line, long size)
+{
+	// callers may or may not include the newline
+	if (size && line[size - 1] == '\n')
+		size--;
+	return size;
+}
+
+// find last checkpoint at or before byte offset
+void col_index_seek_offset(struct col_pos *pos, const unsigned char *line, long size, bool ctrl_tabs, long offset)
+{
+	struct col_index *ci;
+	long lo, hi;
+
+	clear(pos);
+	size = line_length(line, size);
+	if (size < MIN_LINE_SIZE)
+		return;
+
+	ci = get_index(line, ctrl_tabs);
+	extend(ci, size, offset, UINT_MAX);
+
+	lo = 0;
+	hi = ci->count;
+	while (hi - lo > 1) {
+		long mid = (lo + hi) / 2;
+
+		if (ci->checkpoints[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*pos = ci->checkpoints[lo];
+}
+
+// find last checkpoint before display column col
+void col_index_seek_col(struct col_pos *pos, const unsigned char *line, long size, bool ctrl_tabs, unsigned int col)
+{
+	struct col_index *ci;
+	long lo, hi;
+
+	clear(pos);
+	size = line_length(line, size);
+	if (size < MIN_LINE_SIZE || !col)
+		return;
+
+	ci = get_index(line, ctrl_tabs);
+	extend(ci, size, LONG_MAX, col);
+
+	lo = 0;
+	hi = ci->count;
+	while (hi - lo > 1) {
+		long mid = (lo + hi) / 2;
+
+		if (ci->checkpoints[mid].col < col)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*pos = ci->checkpoints[lo];
+}
+
+// called before text at bi is changed in the current buffer
+void col_index_begin_edit(const struct block_iter *bi)
+{
+	struct block_iter tmp = *bi;
+	const unsigned char *cursor;
+	int i;
+
+	block_iter_normalize(&tmp);
+	cursor = (const unsigned char *)tmp.blk->data + tmp.offset;
+	edited = NULL;
+	for (i = 0; i < NR_ENTRIES; i++) {
+		struct col_index *ci = &entries[i];
+
+		if (!ci->line || ci->buffer_id != buffer->id)
+			continue;
+		if (ci->line >= (const unsigned char *)tmp.blk->data && ci->line <= cursor &&
+		    (!edited || ci->line > edited->line)) {
+			if (edited)
+				edited->line = NULL;
+			edited = ci;
+		} else {
+			ci->line = NULL;
+		}
+	}
+	if (edited && memchr(edited->line, '\n', cursor - edited->line)) {
+		edited->line = NULL;
+		edited = NULL;
+	}
+	if (edited)
+		edited_pos = cursor - edited->line;
+}
+
+// called after the edit, bi is still at the edited position
+void col_index_end_edit(const struct block_iter *bi)
+{
+	struct block_iter tmp = *bi;
+	struct col_index *ci = edited;
+	long lo, hi;
+
+	if (!ci)
+		return;
+	edited = NULL;
+	block_iter_normalize(&tmp);
+	if (tmp.offset < edited_pos) {
+		ci->line = NULL;
+		return;
+	}
+	ci->line = (const unsigned char *)tmp.blk->data + tmp.offset - edited_pos;
+
+	// checkpoints at or before the edited byte are still valid
+	lo = 0;
+	hi = ci->count;
+	while (hi - lo > 1) {
+		long mid = (lo + hi) / 2;
+
+		if (ci->checkpoints[mid].offset <= edited_pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	ci->count = lo + 1;
+	ci->complete = false;
+}
+
+// must be called whenever lines of b move without col_index_begin_edit()
+void col_index_forget(const struct buffer *b)
+{
+	int i;
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		if (entries[i].buffer_id == b->id)
+			entries[i].line = NULL;
+	}
+}
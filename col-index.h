@@ -0,0 +1,22 @@
+#ifndef COL_INDEX_H
+#define COL_INDEX_H
+
+#include "libc.h"
+
+struct block_iter;
+struct buffer;
+
+// position of a character in a line
+struct col_pos {
+	long offset;
+	long chars;
+	unsigned int col;
+};
+
+void col_index_seek_offset(struct col_pos *pos, const unsigned char *line, long size, bool ctrl_tabs, long offset);
+void col_index_seek_col(struct col_pos *pos, const unsigned char *line, long size, bool ctrl_tabs, unsigned int col);
+void col_index_begin_edit(const struct block_iter *bi);
+void col_index_end_edit(const struct block_iter *bi);
+void col_index_forget(const struct buffer *b);
+
+#endif
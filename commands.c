@@ -17,7 +17,10 @@
 #include "bind.h"
 #include "alias.h"
 #include "tag.h"
+#include "indexer.h"
 #include "config.h"
+#include "journal.h"
+#include "follow.h"
 #include "command.h"
 #include "parse-args.h"
 #include "file-option.h"
@@ -29,7 +32,9 @@
 #include "path.h"
 #include "error.h"
 #include "input-special.h"
+#include "screen.h"
 #include "git-open.h"
+#include "words.h"
 
 static void cmd_alias(const char *pf, char **args)
 {
@@ -153,12 +158,21 @@ static void cmd_compile(const char *pf, char **args)
 		error_msg("No such error parser %s", name);
 		return;
 	}
+	if (compiler_running()) {
+		error_msg("Compiler is already running.");
+		return;
+	}
 	clear_messages();
 	spawn_compiler(args, flags, c);
 	if (message_count())
 		current_message(1);
 }
 
+static void cmd_complete_word(const char *pf, char **args)
+{
+	complete_word();
+}
+
 static void cmd_copy(const char *pf, char **args)
 {
 	struct block_iter save = view->cursor;
@@ -355,6 +369,11 @@ static void cmd_include(const char *pf, char **args)
 	read_config(commands, args[0], true);
 }
 
+static void cmd_index_tags(const char *pf, char **args)
+{
+	index_tags(args);
+}
+
 static void cmd_insert(const char *pf, char **args)
 {
 	const char *str = args[0];
@@ -372,8 +391,7 @@ static void cmd_insert(const char *pf, char **args)
 			unselect();
 		}
 
-		buffer_replace_bytes(del_len, str, ins_len);
-		if (strchr(pf, 'm'))
+		if (buffer_replace_bytes(del_len, str, ins_len) && strchr(pf, 'm'))
 			block_iter_skip_bytes(&view->cursor, ins_len);
 	}
 }
@@ -740,6 +758,11 @@ static void cmd_save(const char *pf, char **args)
 	struct stat st;
 	bool new_locked = false;
 
+	if (buffer_incomplete(buffer)) {
+		error_msg("File is not completely loaded.");
+		return;
+	}
+
 	while (*pf) {
 		switch (*pf) {
 		case 'd':
@@ -861,6 +884,13 @@ static void cmd_save(const char *pf, char **args)
 
 	buffer->saved_change = buffer->cur_change;
 	buffer->ro = false;
+	journal_discard(buffer);
+	reindex_file(absolute);
+	if (buffer->follow_wd) {
+		// file was replaced, watch the new one
+		unfollow_buffer(buffer);
+		follow_changed();
+	}
 	buffer->newline = newline;
 	if (encoding != buffer->encoding) {
 		free(buffer->encoding);
@@ -1035,8 +1065,8 @@ static void cmd_select(const char *pf, char **args)
 		return;
 	}
 
-	view->sel_so = block_iter_get_offset(&view->cursor);
-	view->sel_eo = UINT_MAX;
+	mark_move(&view->sel_so, block_iter_get_offset(&view->cursor));
+	mark_remove(&view->sel_eo);
 	view->selection = sel;
 
 	// need to mark current line changed because cursor might
@@ -1202,6 +1232,26 @@ static void cmd_undo(const char *pf, char **args)
 	}
 }
 
+static void cmd_undo_stats(const char *pf, char **args)
+{
+	struct undo_stats s;
+	long total = 0;
+	int i, j;
+
+	for (i = 0; i < windows.count; i++) {
+		for (j = 0; j < WINDOW(i)->views.count; j++) {
+			struct view *v = VIEW(i, j);
+			// count each buffer once
+			if (v->buffer->views.ptrs[0] == v)
+				total += v->buffer->undo_size;
+		}
+	}
+
+	undo_stats(&s);
+	info_msg("%ld changes in %ld KiB, deleted text %ld KiB stored in %ld KiB. All buffers %ld KiB, limit %d MiB per buffer.",
+		s.changes, s.memory / 1024, s.text / 1024, s.stored_text / 1024, total / 1024, options.undo_limit);
+}
+
 static void cmd_unselect(const char *pf, char **args)
 {
 	unselect();
@@ -1271,6 +1321,7 @@ static void cmd_wclose(const char *pf, char **args)
 	w = ptr_array_remove(&windows, idx);
 	remove_frame(w->frame);
 	free(w->views.ptrs);
+	free_rendered_lines(w);
 	free(w);
 
 	if (idx == windows.count)
@@ -1448,6 +1499,7 @@ const struct command commands[] = {
 	{ "close",		"f",	0,  0, cmd_close },
 	{ "command",		"",	0,  1, cmd_command },
 	{ "compile",		"-1ps",	2, -1, cmd_compile },
+	{ "complete-word",	"",	0,  0, cmd_complete_word },
 	{ "copy",		"",	0,  0, cmd_copy },
 	{ "cut",		"",	0,  0, cmd_cut },
 	{ "delete",		"",	0,  0, cmd_delete },
@@ -1466,6 +1518,7 @@ const struct command commands[] = {
 	{ "git-open",		"",	0,  0, cmd_git_open },
 	{ "hi",			"-",	0, -1, cmd_hi },
 	{ "include",		"",	1,  1, cmd_include },
+	{ "index-tags",		"",	0, -1, cmd_index_tags },
 	{ "insert",		"km",	1,  1, cmd_insert },
 	{ "insert-special",	"",	0,  0, cmd_insert_special },
 	{ "join",		"",	0,  0, cmd_join },
@@ -1503,6 +1556,7 @@ const struct command commands[] = {
 	{ "tag",		"r",	0,  1, cmd_tag },
 	{ "toggle",		"glv",	1, -1, cmd_toggle },
 	{ "undo",		"",	0,  0, cmd_undo },
+	{ "undo-stats",		"",	0,  0, cmd_undo_stats },
 	{ "unselect",		"",	0,  0, cmd_unselect },
 	{ "up",			"",	0,  0, cmd_up },
 	{ "view",		"",	1,  1, cmd_view },
@@ -179,6 +179,31 @@ long stat_read_file(const char *filename, char **bufp, struct stat *st)
 	return r;
 }
 
+// file type (S_IFDIR etc.) of a directory entry, 0 if d_type is not known
+mode_t dirent_type(const struct dirent *de)
+{
+#ifdef DT_UNKNOWN
+	// saves a stat() if the file system fills d_type
+	switch (de->d_type) {
+	case DT_DIR:
+		return S_IFDIR;
+	case DT_REG:
+		return S_IFREG;
+	case DT_LNK:
+		return S_IFLNK;
+	case DT_FIFO:
+		return S_IFIFO;
+	case DT_SOCK:
+		return S_IFSOCK;
+	case DT_CHR:
+		return S_IFCHR;
+	case DT_BLK:
+		return S_IFBLK;
+	}
+#endif
+	return 0;
+}
+
 char *buf_next_line(char *buf, ssize_t *posp, ssize_t size)
 {
 	ssize_t pos = *posp;
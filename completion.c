@@ -60,31 +60,122 @@ static void collect_commands(const char *prefix)
 	collect_aliases(prefix);
 }
 
+/*
+ * Directory listings are cached so that pressing tab again in a big
+ * directory doesn't read it again. A listing is used only if the mtime of
+ * the directory hasn't changed since it was read and the listing was read
+ * at least a second after that mtime.
+ */
+#define MAX_DIR_LISTINGS 8
+
+struct dir_entry {
+	// S_IFDIR etc., 0 until an unknown d_type has been looked up
+	mode_t type;
+	char name[];
+};
+
+struct dir_listing {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t read_time;
+	struct ptr_array entries;
+};
+
+// most recently used first
+static PTR_ARRAY(dir_listings);
+
+static void free_dir_listing(struct dir_listing *l)
+{
+	ptr_array_free(&l->entries);
+	free(l);
+}
+
+static struct dir_listing *read_dir_listing(const char *dirname, const struct stat *st)
+{
+	struct dir_listing *l;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return NULL;
+
+	l = xnew0(struct dir_listing, 1);
+	l->dev = st->st_dev;
+	l->ino = st->st_ino;
+	l->mtime = st->st_mtime;
+	l->read_time = time(NULL);
+	while ((de = readdir(dir))) {
+		int len = strlen(de->d_name);
+		struct dir_entry *e = xmalloc(sizeof(*e) + len + 1);
+
+		e->type = dirent_type(de);
+		memcpy(e->name, de->d_name, len + 1);
+		ptr_array_add(&l->entries, e);
+	}
+	closedir(dir);
+	return l;
+}
+
+static struct dir_listing *get_dir_listing(const char *dirname)
+{
+	struct dir_listing *l;
+	struct stat st;
+	int i;
+
+	if (stat(dirname, &st))
+		return NULL;
+
+	for (i = 0; i < dir_listings.count; i++) {
+		l = dir_listings.ptrs[i];
+		if (l->dev == st.st_dev && l->ino == st.st_ino)
+			break;
+	}
+	if (i < dir_listings.count) {
+		ptr_array_remove(&dir_listings, i);
+		if (l->mtime == st.st_mtime && l->read_time > l->mtime) {
+			ptr_array_insert(&dir_listings, l, 0);
+			return l;
+		}
+		free_dir_listing(l);
+	}
+
+	l = read_dir_listing(dirname, &st);
+	if (!l)
+		return NULL;
+	ptr_array_insert(&dir_listings, l, 0);
+	if (dir_listings.count > MAX_DIR_LISTINGS)
+		free_dir_listing(ptr_array_remove(&dir_listings, dir_listings.count - 1));
+	return l;
+}
+
 static void do_collect_files(const char *dirname, const char *dirprefix, const char *fileprefix, bool directories_only)
 {
 	char path[8192];
 	int plen = strlen(dirname);
 	int dlen = strlen(dirprefix);
 	int flen = strlen(fileprefix);
-	struct dirent *de;
-	DIR *dir;
+	struct dir_listing *l;
+	int i;
 
 	if (plen >= sizeof(path) - 2)
 		return;
 
-	dir = opendir(dirname);
-	if (!dir)
+	l = get_dir_listing(dirname);
+	if (!l)
 		return;
 
 	memcpy(path, dirname, plen);
 	if (path[plen - 1] != '/')
 		path[plen++] = '/';
 
-	while ((de = readdir(dir))) {
-		const char *name = de->d_name;
+	for (i = 0; i < l->entries.count; i++) {
+		struct dir_entry *e = l->entries.ptrs[i];
+		const char *name = e->name;
 		struct stat st;
-		int len;
 		bool is_dir;
+		int len;
 		char *c;
 
 		if (flen) {
@@ -99,14 +190,14 @@ static void do_collect_files(const char *dirname, const char *dirprefix, const c
 		if (plen + len + 2 > sizeof(path))
 			continue;
 		memcpy(path + plen, name, len + 1);
-
-		if (lstat(path, &st))
-			continue;
-
-		is_dir = S_ISDIR(st.st_mode);
-		if (S_ISLNK(st.st_mode)) {
-			if (!stat(path, &st))
-				is_dir = S_ISDIR(st.st_mode);
+		if (!e->type && !lstat(path, &st))
+			e->type = st.st_mode & S_IFMT;
+		if (e->type == S_IFLNK) {
+			// target can change without the directory changing so
+			// it is not cached, broken link is not a directory
+			is_dir = !stat(path, &st) && S_ISDIR(st.st_mode);
+		} else {
+			is_dir = e->type == S_IFDIR;
 		}
 		if (!is_dir && directories_only)
 			continue;
@@ -120,7 +211,6 @@ static void do_collect_files(const char *dirname, const char *dirprefix, const c
 		}
 		add_completion(c);
 	}
-	closedir(dir);
 }
 
 static void collect_files(bool directories_only)
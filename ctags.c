@@ -1,23 +1,99 @@
 #include "ctags.h"
 #include "common.h"
+#include "ctype.h"
+
+#include <sys/mman.h>
+
+/*
+ * Tags with the same name are scattered around an unsorted tags file.
+ * Instead of scanning the whole file for every lookup an index is built
+ * and saved to a file:
+ *
+ *     struct tag_index_header
+ *     long index[nr_index]     offsets of tag lines sorted by name
+ *     long hash[hash_size]     1 + position of first tag of a name in index
+ *
+ * The index is mmapped together with the tags file so nothing needs to be
+ * parsed before lookups. Offsets read from the file are checked only when
+ * they are used.
+ */
+
+#define TAG_INDEX_MAGIC "dex-tagi"
+
+struct tag_index_header {
+	char magic[8];
+	unsigned long long dev;
+	unsigned long long ino;
+	long long mtime;
+	long size;
+	long nr_index;
+	long hash_size;
+};
+
+// pseudo tags are at beginning of the file
+static int parse_sorted(const char *buf, long size)
+{
+	static const char name[] = "!_TAG_FILE_SORTED\t";
+	int len = sizeof(name) - 1;
+	long pos = 0;
+
+	while (pos < size && buf[pos] == '!') {
+		const char *line = buf + pos;
+		const char *end = memchr(line, '\n', size - pos);
+		long n = end ? end - line : size - pos;
+
+		if (n > len && !memcmp(line, name, len)) {
+			if (line[len] == '1')
+				return 1;
+			if (line[len] == '2')
+				return 2;
+			return 0;
+		}
+		pos += n + 1;
+	}
+	return 0;
+}
 
 struct tag_file *open_tag_file(const char *filename)
 {
-	struct tag_file *tf = xnew0(struct tag_file, 1);
+	struct tag_file *tf;
 	struct stat st;
+	int fd;
 
-	tf->size = stat_read_file(filename, &tf->map, &st);
-	if (tf->size < 0) {
-		free(tf);
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
 		return NULL;
 	}
+
+	tf = xnew0(struct tag_file, 1);
+	tf->size = st.st_size;
+	if (tf->size) {
+		tf->map = mmap(NULL, tf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (tf->map == MAP_FAILED) {
+			close(fd);
+			free(tf);
+			return NULL;
+		}
+	}
+	close(fd);
 	tf->mtime = st.st_mtime;
+	tf->filename = xstrdup(filename);
+	tf->dev = st.st_dev;
+	tf->ino = st.st_ino;
+	tf->sorted = parse_sorted(tf->map, tf->size);
 	return tf;
 }
 
 void close_tag_file(struct tag_file *tf)
 {
-	free(tf->map);
+	if (tf->size)
+		munmap(tf->map, tf->size);
+	if (tf->index_map)
+		munmap(tf->index_map, tf->index_map_size);
+	free(tf->filename);
 	free(tf);
 }
 
@@ -139,11 +215,356 @@ error:
 	return false;
 }
 
+/*
+ * Compare beginning of a line to prefix in the order the file is sorted.
+ * Name of an exact match is followed by a tab.
+ */
+static int prefix_cmp(const char *line, size_t len, const char *prefix, size_t prefix_len, int exact, bool fold)
+{
+	size_t i, n;
+
+	if (exact)
+		prefix_len++;
+	n = len < prefix_len ? len : prefix_len;
+	for (i = 0; i < n; i++) {
+		int a = (unsigned char)line[i];
+		int b = exact && i == prefix_len - 1 ? '\t' : (unsigned char)prefix[i];
+
+		if (fold) {
+			a = toupper(a);
+			b = toupper(b);
+		}
+		if (a != b)
+			return a - b;
+	}
+	return len < prefix_len ? -1 : 0;
+}
+
+static size_t line_end(const struct tag_file *tf, size_t pos)
+{
+	const char *end = memchr(tf->map + pos, '\n', tf->size - pos);
+
+	return end ? end - tf->map : tf->size;
+}
+
+static unsigned long name_hash(const char *name, size_t len)
+{
+	// FNV-1a
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static size_t name_len_at(const struct tag_file *tf, long pos)
+{
+	long i = pos;
+
+	while (i < tf->size && tf->map[i] != '\t' && tf->map[i] != '\n')
+		i++;
+	return i - pos;
+}
+
+static int name_cmp(const struct tag_file *tf, long a, long b)
+{
+	size_t alen = name_len_at(tf, a);
+	size_t blen = name_len_at(tf, b);
+	int ret = memcmp(tf->map + a, tf->map + b, alen < blen ? alen : blen);
+
+	if (ret)
+		return ret;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static const struct tag_file *sort_tf; // for sorting the index
+
+struct index_entry {
+	// first bytes of the name, compared before the whole name
+	unsigned long long key;
+	long pos;
+};
+
+static unsigned long long name_key(const struct tag_file *tf, long pos)
+{
+	unsigned long long key = 0;
+	size_t len = name_len_at(tf, pos);
+	size_t i;
+
+	for (i = 0; i < sizeof(key); i++) {
+		key <<= 8;
+		if (i < len)
+			key |= (unsigned char)tf->map[pos + i];
+	}
+	return key;
+}
+
+static int index_cmp(const void *ap, const void *bp)
+{
+	const struct index_entry *a = ap;
+	const struct index_entry *b = bp;
+	int ret;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	ret = name_cmp(sort_tf, a->pos, b->pos);
+	if (ret)
+		return ret;
+	// keep order of the file
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+static bool indexed_line(const struct tag_file *tf, long pos)
+{
+	return tf->map[pos] != '\n' && tf->map[pos] != '!';
+}
+
+char *build_tag_index(const struct tag_file *tf, long *sizep)
+{
+	struct tag_index_header h;
+	struct index_entry *entries;
+	long *index, *hash;
+	long pos, i;
+	char *buf;
+
+	clear(&h);
+	memcpy(h.magic, TAG_INDEX_MAGIC, sizeof(h.magic));
+	h.dev = tf->dev;
+	h.ino = tf->ino;
+	h.mtime = tf->mtime;
+	h.size = tf->size;
+	for (pos = 0; pos < tf->size; pos = line_end(tf, pos) + 1) {
+		if (indexed_line(tf, pos))
+			h.nr_index++;
+	}
+	h.hash_size = 16;
+	while (h.hash_size < h.nr_index * 2)
+		h.hash_size *= 2;
+
+	*sizep = sizeof(h) + (h.nr_index + h.hash_size) * sizeof(long);
+	buf = xmalloc(*sizep);
+	memcpy(buf, &h, sizeof(h));
+	index = (long *)(buf + sizeof(h));
+	hash = index + h.nr_index;
+
+	entries = xnew(struct index_entry, h.nr_index);
+	i = 0;
+	for (pos = 0; pos < tf->size; pos = line_end(tf, pos) + 1) {
+		if (indexed_line(tf, pos)) {
+			entries[i].key = name_key(tf, pos);
+			entries[i++].pos = pos;
+		}
+	}
+	sort_tf = tf;
+	qsort(entries, h.nr_index, sizeof(*entries), index_cmp);
+	for (i = 0; i < h.nr_index; i++)
+		index[i] = entries[i].pos;
+	free(entries);
+
+	memset(hash, 0, h.hash_size * sizeof(*hash));
+	for (i = 0; i < h.nr_index; i++) {
+		unsigned long j;
+
+		if (i && !name_cmp(tf, index[i - 1], index[i]))
+			continue;
+		j = name_hash(tf->map + index[i], name_len_at(tf, index[i]));
+		j &= h.hash_size - 1;
+		while (hash[j])
+			j = (j + 1) & (h.hash_size - 1);
+		hash[j] = i + 1;
+	}
+	return buf;
+}
+
+// buf must stay valid until the tag file is closed
+bool set_tag_index(struct tag_file *tf, char *buf, long size)
+{
+	struct tag_index_header h;
+
+	if (size < (long)sizeof(h))
+		return false;
+	memcpy(&h, buf, sizeof(h));
+	if (memcmp(h.magic, TAG_INDEX_MAGIC, sizeof(h.magic)))
+		return false;
+	if (h.dev != (unsigned long long)tf->dev || h.ino != (unsigned long long)tf->ino ||
+	    h.mtime != (long long)tf->mtime || h.size != tf->size) {
+		// tags file has been regenerated
+		return false;
+	}
+	if (h.nr_index < 0 || h.hash_size <= 0 || (h.hash_size & (h.hash_size - 1)))
+		return false;
+	if (h.nr_index > (size - (long)sizeof(h)) / (long)sizeof(long) ||
+	    h.hash_size != (size - (long)sizeof(h)) / (long)sizeof(long) - h.nr_index)
+		return false;
+
+	tf->index = (const long *)(buf + sizeof(h));
+	tf->nr_index = h.nr_index;
+	tf->hash = tf->index + h.nr_index;
+	tf->hash_size = h.hash_size;
+	return true;
+}
+
+bool write_tag_index(const struct tag_file *tf, const char *filename)
+{
+	char *tmp = xsprintf("%s.tmp", filename);
+	long size;
+	char *buf = build_tag_index(tf, &size);
+	bool ok = false;
+	int fd;
+
+	fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd >= 0) {
+		ok = xwrite(fd, buf, size) == size;
+		close(fd);
+		if (ok)
+			ok = !rename(tmp, filename);
+		if (!ok)
+			unlink(tmp);
+	}
+	free(buf);
+	free(tmp);
+	return ok;
+}
+
+bool load_tag_index(struct tag_file *tf, const char *filename)
+{
+	struct stat st;
+	char *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	if (!set_tag_index(tf, map, st.st_size)) {
+		munmap(map, st.st_size);
+		unlink(filename);
+		return false;
+	}
+	tf->index_map = map;
+	tf->index_map_size = st.st_size;
+	return true;
+}
+
+// find first line which does not sort before prefix
+static size_t lower_bound(const struct tag_file *tf, const char *prefix, size_t prefix_len, int exact)
+{
+	size_t lo = 0, hi = tf->size;
+
+	// lo is always at beginning of a line
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		size_t start = mid, end;
+
+		while (start > lo && tf->map[start - 1] != '\n')
+			start--;
+		end = line_end(tf, start);
+		if (prefix_cmp(tf->map + start, end - start, prefix, prefix_len, exact, tf->sorted == 2) < 0) {
+			lo = end + 1;
+		} else {
+			hi = start;
+		}
+	}
+	return lo;
+}
+
+// first position in index which does not sort before prefix
+static long index_lower_bound(const struct tag_file *tf, const char *prefix, size_t prefix_len)
+{
+	long lo = 0, hi = tf->nr_index;
+
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		long pos = tf->index[mid];
+
+		if (pos < 0 || pos >= tf->size) {
+			hi = mid;
+			continue;
+		}
+		if (prefix_cmp(tf->map + pos, line_end(tf, pos) - pos, prefix, prefix_len, 0, false) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static long index_lookup(const struct tag_file *tf, const char *name, size_t len)
+{
+	unsigned long mask = tf->hash_size - 1;
+	unsigned long j = name_hash(name, len) & mask;
+	long n;
+
+	for (n = 0; n < tf->hash_size; n++, j = (j + 1) & mask) {
+		long i = tf->hash[j] - 1;
+		long pos;
+
+		if (i < 0 || i >= tf->nr_index)
+			break;
+		pos = tf->index[i];
+		if (pos < 0 || pos >= tf->size)
+			break;
+		if (!prefix_cmp(tf->map + pos, line_end(tf, pos) - pos, name, len, 1, false))
+			return i;
+	}
+	return tf->nr_index;
+}
+
+static bool next_indexed_tag(struct tag_file *tf, size_t *posp, const char *prefix, int exact, struct tag *t)
+{
+	size_t prefix_len = strlen(prefix);
+	long i;
+
+	if (*posp)
+		i = *posp - 1;
+	else if (exact)
+		i = index_lookup(tf, prefix, prefix_len);
+	else
+		i = index_lower_bound(tf, prefix, prefix_len);
+
+	for (; i < tf->nr_index; i++) {
+		long pos = tf->index[i];
+		size_t len;
+
+		if (pos < 0 || pos >= tf->size)
+			break;
+		len = line_end(tf, pos) - pos;
+		if (prefix_cmp(tf->map + pos, len, prefix, prefix_len, exact, false))
+			break;
+		if (!parse_line(t, tf->map + pos, len))
+			continue;
+
+		*posp = i + 2;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Tags with the prefix are next to each other in a sorted file or in the
+ * index so they are found by binary search and scanning stops after them.
+ */
 bool next_tag(struct tag_file *tf, size_t *posp, const char *prefix, int exact, struct tag *t)
 {
 	size_t prefix_len = strlen(prefix);
 	size_t pos = *posp;
 
+	if (tf->index)
+		return next_indexed_tag(tf, posp, prefix, exact, t);
+	if (tf->sorted && !pos)
+		pos = lower_bound(tf, prefix, prefix_len, exact);
+
 	while (pos < tf->size) {
 		size_t len = tf->size - pos;
 		char *line = tf->map + pos;
@@ -156,6 +577,9 @@ bool next_tag(struct tag_file *tf, size_t *posp, const char *prefix, int exact,
 		if (!len || line[0] == '!')
 			continue;
 
+		if (tf->sorted && prefix_cmp(line, len, prefix, prefix_len, exact, tf->sorted == 2) > 0)
+			break;
+
 		if (len <= prefix_len || memcmp(line, prefix, prefix_len))
 			continue;
 
@@ -7,6 +7,23 @@ struct tag_file {
 	char *map;
 	long size;
 	time_t mtime;
+
+	// !_TAG_FILE_SORTED: 0 unsorted, 1 sorted, 2 sorted ignoring case
+	int sorted;
+
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+
+	// offsets of tag lines sorted by name and hash table of names for
+	// unsorted files, see write_tag_index()
+	const long *index;
+	long nr_index;
+	const long *hash;
+	long hash_size;
+	char *index_map;
+	long index_map_size;
+	bool index_failed;
 };
 
 struct tag {
@@ -22,6 +39,10 @@ struct tag {
 
 struct tag_file *open_tag_file(const char *filename);
 void close_tag_file(struct tag_file *tf);
+char *build_tag_index(const struct tag_file *tf, long *sizep);
+bool set_tag_index(struct tag_file *tf, char *buf, long size);
+bool write_tag_index(const struct tag_file *tf, const char *filename);
+bool load_tag_index(struct tag_file *tf, const char *filename);
 bool next_tag(struct tag_file *tf, size_t *posp, const char *prefix, int exact, struct tag *t);
 void free_tag(struct tag *t);
 
@@ -77,8 +77,8 @@ void select_block(void)
 	}
 
 	view->cursor = sbi;
-	view->sel_so = block_iter_get_offset(&ebi);
-	view->sel_eo = UINT_MAX;
+	mark_move(&view->sel_so, block_iter_get_offset(&ebi));
+	mark_remove(&view->sel_eo);
 	view->selection = SELECT_LINES;
 
 	mark_all_lines_changed();
@@ -147,8 +147,8 @@ void insert_text(const char *text, long size)
 		del_count = prepare_selection();
 		unselect();
 	}
-	buffer_replace_bytes(del_count, text, size);
-	block_iter_skip_bytes(&view->cursor, size);
+	if (buffer_replace_bytes(del_count, text, size))
+		block_iter_skip_bytes(&view->cursor, size);
 }
 
 void paste(void)
@@ -271,6 +271,7 @@ static void insert_nl(void)
 	long del_count = 0;
 	long ins_count = 1;
 	char *ins = NULL;
+	bool inserted;
 
 	// prepare deleted text (selection or whitespace around cursor)
 	if (selecting()) {
@@ -310,21 +311,23 @@ static void insert_nl(void)
 		ins[0] = '\n';
 		ins_count++;
 
-		buffer_replace_bytes(del_count, ins, ins_count);
+		inserted = buffer_replace_bytes(del_count, ins, ins_count);
 		free(ins);
 	} else {
-		buffer_replace_bytes(del_count, "\n", ins_count);
+		inserted = buffer_replace_bytes(del_count, "\n", ins_count);
 	}
 	end_change();
 
 	// move after inserted text
-	block_iter_skip_bytes(&view->cursor, ins_count);
+	if (inserted)
+		block_iter_skip_bytes(&view->cursor, ins_count);
 }
 
 void insert_ch(unsigned int ch)
 {
 	long del_count = 0;
 	long ins_count = 0;
+	bool inserted;
 	char *ins;
 
 	if (ch == '\n') {
@@ -374,11 +377,12 @@ void insert_ch(unsigned int ch)
 	} else {
 		begin_change(CHANGE_MERGE_INSERT);
 	}
-	buffer_replace_bytes(del_count, ins, ins_count);
+	inserted = buffer_replace_bytes(del_count, ins, ins_count);
 	end_change();
 
 	// move after inserted text
-	block_iter_skip_bytes(&view->cursor, ins_count);
+	if (inserted)
+		block_iter_skip_bytes(&view->cursor, ins_count);
 
 	free(ins);
 }
@@ -577,14 +581,14 @@ void shift_lines(int count)
 		if (info.swapped) {
 			// cursor should be at beginning of selection
 			block_iter_bol(&view->cursor);
-			view->sel_so = block_iter_get_offset(&view->cursor);
+			mark_move(&view->sel_so, block_iter_get_offset(&view->cursor));
 			while (--nr_lines)
 				block_iter_prev_line(&view->cursor);
 		} else {
 			struct block_iter save = view->cursor;
 			while (--nr_lines)
 				block_iter_prev_line(&view->cursor);
-			view->sel_so = block_iter_get_offset(&view->cursor);
+			mark_move(&view->sel_so, block_iter_get_offset(&view->cursor));
 			view->cursor = save;
 		}
 	}
@@ -624,14 +628,15 @@ void clear_lines(void)
 
 	if (indent)
 		ins_count = strlen(indent);
-	buffer_replace_bytes(del_count, indent, ins_count);
-	block_iter_skip_bytes(&view->cursor, ins_count);
+	if (buffer_replace_bytes(del_count, indent, ins_count))
+		block_iter_skip_bytes(&view->cursor, ins_count);
 }
 
 void new_line(void)
 {
 	long ins_count = 1;
 	char *ins = NULL;
+	bool inserted;
 
 	block_iter_eol(&view->cursor);
 
@@ -650,13 +655,14 @@ void new_line(void)
 		memmove(ins + 1, ins, ins_count);
 		ins[0] = '\n';
 		ins_count++;
-		buffer_insert_bytes(ins, ins_count);
+		inserted = buffer_insert_bytes(ins, ins_count);
 		free(ins);
 	} else {
-		buffer_insert_bytes("\n", 1);
+		inserted = buffer_insert_bytes("\n", 1);
 	}
 
-	block_iter_skip_bytes(&view->cursor, ins_count);
+	if (inserted)
+		block_iter_skip_bytes(&view->cursor, ins_count);
 }
 
 static void add_word(struct paragraph_formatter *pf, const char *word, int len)
@@ -795,8 +801,7 @@ void format_paragraph(int text_width)
 
 	if (pf.buf.len)
 		gbuf_add_ch(&pf.buf, '\n');
-	buffer_replace_bytes(len, pf.buf.buffer, pf.buf.len);
-	if (pf.buf.len)
+	if (buffer_replace_bytes(len, pf.buf.buffer, pf.buf.len) && pf.buf.len)
 		block_iter_skip_bytes(&view->cursor, pf.buf.len - 1);
 	gbuf_free(&pf.buf);
 	free(pf.indent);
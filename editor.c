@@ -10,6 +10,11 @@
 #include "command.h"
 #include "modes.h"
 #include "error.h"
+#include "journal.h"
+#include "load-save.h"
+#include "fork.h"
+
+#include <poll.h>
 
 enum editor_status editor_status;
 enum input_mode input_mode;
@@ -19,6 +24,10 @@ char *charset;
 bool child_controls_terminal;
 bool resized;
 int cmdline_x;
+unsigned long frames_skipped;
+
+// keys arriving faster than this are processed without redrawing in between
+#define INPUT_LATENCY_BUDGET_MS 50
 
 static void sanity_check(void)
 {
@@ -87,13 +96,13 @@ static void restore_cursor(void)
 {
 	switch (input_mode) {
 	case INPUT_NORMAL:
-		buf_move_cursor(
+		buf_move_term_cursor(
 			window->edit_x + view->cx_display - view->vx,
 			window->edit_y + view->cy - view->vy);
 		break;
 	case INPUT_COMMAND:
 	case INPUT_SEARCH:
-		buf_move_cursor(cmdline_x, screen_h - 1);
+		buf_move_term_cursor(cmdline_x, screen_h - 1);
 		break;
 	case INPUT_GIT_OPEN:
 		break;
@@ -109,6 +118,7 @@ static void end_update(void)
 {
 	int i;
 
+	buf_flush_cells();
 	restore_cursor();
 	buf_show_cursor();
 	buf_flush();
@@ -178,7 +188,7 @@ static void update_windows(void)
 			if (view != save) {
 				// restore cursor
 				view->cursor.blk = BLOCK(view->buffer->blocks.next);
-				block_iter_goto_offset(&view->cursor, view->saved_cursor_offset);
+				block_iter_goto_offset(&view->cursor, mark_offset(&view->saved_cursor));
 
 				// these have already been updated for current view
 				update_cursor_x();
@@ -202,16 +212,35 @@ void normal_update(void)
 	end_update();
 }
 
+// show message of a long operation without redrawing anything else
+void update_progress(void)
+{
+	start_update();
+	update_command_line();
+	buf_flush_cells();
+	buf_flush();
+}
+
 void resize(void)
 {
 	resized = false;
 	update_screen_size();
 
+	// screen may have been cleared or used by another program
+	buf_invalidate();
+
 	// "dtach -r winch" sends SIGWINCH after program has been attached
 	if (term_cap.strings[STR_CAP_CMD_ks]) {
 		// turn keypad on (makes cursor keys work)
 		buf_escape(term_cap.strings[STR_CAP_CMD_ks]);
 	}
+
+	// tell apart pasted text from typed keys, ignored if not supported
+	buf_escape("\033[?2004h");
+
+	// synchronized output is used only if the terminal answers this
+	if (options.synchronized_output)
+		buf_escape(term_query_sync());
 	if (term_cap.strings[STR_CAP_CMD_ti]) {
 		// use alternate buffer if possible
 		buf_escape(term_cap.strings[STR_CAP_CMD_ti]);
@@ -224,8 +253,8 @@ void ui_end(void)
 {
 	struct term_color color = { -1, -1, 0 };
 
-	buf_set_color(&color);
-	buf_move_cursor(0, screen_h - 1);
+	buf_set_term_color(&color);
+	buf_move_term_cursor(0, screen_h - 1);
 	buf_show_cursor();
 
 	// back to main buffer
@@ -236,6 +265,9 @@ void ui_end(void)
 	if (term_cap.strings[STR_CAP_CMD_ke])
 		buf_escape(term_cap.strings[STR_CAP_CMD_ke]);
 
+	// turn bracketed paste mode off
+	buf_escape("\033[?2004l");
+
 	buf_flush();
 	term_cooked();
 }
@@ -345,6 +377,8 @@ static void save_state(struct screen_state *s)
 static void update_screen(struct screen_state *s)
 {
 	if (everything_changed) {
+		// colors or options may have changed
+		forget_rendered_lines();
 		modes[input_mode]->update();
 		everything_changed = false;
 		return;
@@ -356,6 +390,9 @@ static void update_screen(struct screen_state *s)
 
 	if (s->id == buffer->id) {
 		if (s->vx != view->vx || s->vy != view->vy) {
+			// let the terminal move lines which are still visible
+			if (s->vx == view->vx && window->x == 0 && window->w == screen_w)
+				buf_scroll(window->edit_y, window->edit_y + window->edit_h - 1, view->vy - s->vy);
 			mark_all_lines_changed();
 		} else {
 			// Because of trailing whitespace highlighting and
@@ -391,25 +428,310 @@ void set_signal_handler(int signum, void (*handler)(int))
 	sigaction(signum, &act, NULL);
 }
 
+// the current buffer first, then any other buffer still being loaded
+static struct buffer *find_loading_buffer(void)
+{
+	int i, j;
+
+	if (buffer->loader)
+		return buffer;
+	for (i = 0; i < windows.count; i++) {
+		struct window *w = WINDOW(i);
+
+		for (j = 0; j < w->views.count; j++) {
+			struct view *v = w->views.ptrs[j];
+			if (v->buffer->loader)
+				return v->buffer;
+		}
+	}
+	return NULL;
+}
+
+static bool buffer_visible(struct buffer *b)
+{
+	int i;
+
+	for (i = 0; i < b->views.count; i++) {
+		struct view *v = b->views.ptrs[i];
+		if (v->window->view == v)
+			return true;
+	}
+	return false;
+}
+
+static void load_step(struct buffer *b)
+{
+	struct screen_state s;
+	long nl = b->nl;
+	bool done;
+
+	save_state(&s);
+	done = !load_more(b);
+	if (done && b == buffer && b->journal_pending) {
+		// replay was skipped while loading, a buffer loaded in the
+		// background is replayed by set_view()
+		journal_replay();
+	}
+	if (nl < b->changed_line_min)
+		b->changed_line_min = nl;
+	b->changed_line_max = INT_MAX;
+	if (b != buffer && buffer_visible(b))
+		mark_everything_changed();
+	// hidden buffer is redrawn only to show a possible journal message
+	if (b == buffer || buffer_visible(b) || done)
+		update_screen(&s);
+}
+
+static void update_after_event(struct screen_state *s)
+{
+	if (input_mode == INPUT_GIT_OPEN) {
+		modes[input_mode]->update();
+	} else {
+		sanity_check();
+		update_screen(s);
+	}
+}
+
+static long elapsed_ms(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/*
+ * Event loop
+ *
+ * The editor waits in poll() for keys, watched file descriptors (inotify
+ * etc.) and timers. SIGWINCH is delivered through a pipe so that it can't
+ * get lost between checking the resized flag and going to sleep.
+ */
+
+struct fd_watch {
+	int fd;
+	void (*callback)(int fd);
+};
+
+struct timer {
+	struct timeval when;
+	void (*callback)(void);
+};
+
+static PTR_ARRAY(fd_watches);
+static PTR_ARRAY(timers);
+static int signal_pipe[2] = { -1, -1 };
+
+// call callback when fd becomes readable
+void watch_fd(int fd, void (*callback)(int fd))
+{
+	struct fd_watch *w = xnew(struct fd_watch, 1);
+
+	w->fd = fd;
+	w->callback = callback;
+	ptr_array_add(&fd_watches, w);
+}
+
+void unwatch_fd(int fd)
+{
+	int i;
+
+	for (i = 0; i < fd_watches.count; i++) {
+		struct fd_watch *w = fd_watches.ptrs[i];
+		if (w->fd == fd) {
+			free(ptr_array_remove(&fd_watches, i));
+			return;
+		}
+	}
+}
+
+// call callback once after ms milliseconds unless the timer is already set
+void set_timer(long ms, void (*callback)(void))
+{
+	struct timer *t;
+	int i;
+
+	for (i = 0; i < timers.count; i++) {
+		t = timers.ptrs[i];
+		if (t->callback == callback)
+			return;
+	}
+	t = xnew(struct timer, 1);
+	gettimeofday(&t->when, NULL);
+	t->when.tv_sec += ms / 1000;
+	t->when.tv_usec += ms % 1000 * 1000;
+	if (t->when.tv_usec >= 1000000) {
+		t->when.tv_sec++;
+		t->when.tv_usec -= 1000000;
+	}
+	t->callback = callback;
+	ptr_array_add(&timers, t);
+}
+
+// async-signal-safe
+void wake_main_loop(void)
+{
+	if (signal_pipe[1] >= 0) {
+		int saved_errno = errno;
+		write(signal_pipe[1], "", 1);
+		errno = saved_errno;
+	}
+}
+
+static void init_event_loop(void)
+{
+	if (pipe(signal_pipe)) {
+		signal_pipe[0] = -1;
+		signal_pipe[1] = -1;
+		return;
+	}
+	close_on_exec(signal_pipe[0]);
+	close_on_exec(signal_pipe[1]);
+	fcntl(signal_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+// milliseconds until the first timer expires, -1 if there are no timers
+static int poll_timeout(void)
+{
+	long min = -1;
+	int i;
+
+	for (i = 0; i < timers.count; i++) {
+		struct timer *t = timers.ptrs[i];
+		long ms = -elapsed_ms(&t->when);
+
+		if (ms < 0)
+			ms = 0;
+		if (min < 0 || ms < min)
+			min = ms;
+	}
+	return min > INT_MAX ? INT_MAX : min;
+}
+
+static void run_expired_timers(void)
+{
+	int i = 0;
+
+	while (i < timers.count) {
+		struct timer *t = timers.ptrs[i];
+		struct screen_state s;
+
+		if (elapsed_ms(&t->when) < 0) {
+			i++;
+			continue;
+		}
+		// callback may set the timer again
+		ptr_array_remove(&timers, i);
+		save_state(&s);
+		t->callback();
+		update_after_event(&s);
+		free(t);
+	}
+}
+
+// returns true if a key can be read, false if something else happened
+static bool wait_for_input(void)
+{
+	int nr_fds = 2 + fd_watches.count;
+	struct pollfd *fds = xnew(struct pollfd, nr_fds);
+	bool key = false;
+	int i;
+
+	fds[0].fd = 0;
+	fds[1].fd = signal_pipe[0];
+	for (i = 0; i < fd_watches.count; i++) {
+		struct fd_watch *w = fd_watches.ptrs[i];
+		fds[i + 2].fd = w->fd;
+	}
+	for (i = 0; i < nr_fds; i++) {
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+
+	if (poll(fds, nr_fds, poll_timeout()) < 0) {
+		// interrupted by a signal
+		free(fds);
+		return false;
+	}
+
+	if (fds[1].revents) {
+		char buf[64];
+		while (read(signal_pipe[0], buf, sizeof(buf)) > 0)
+			;
+	}
+	run_expired_timers();
+	for (i = 2; i < nr_fds; i++) {
+		struct screen_state s;
+		int j;
+
+		if (!fds[i].revents)
+			continue;
+		// callbacks may remove watches
+		for (j = 0; j < fd_watches.count; j++) {
+			struct fd_watch *w = fd_watches.ptrs[j];
+			if (w->fd == fds[i].fd) {
+				save_state(&s);
+				w->callback(w->fd);
+				update_after_event(&s);
+				break;
+			}
+		}
+	}
+	key = fds[0].revents != 0;
+	free(fds);
+	return key;
+}
+
 void main_loop(void)
 {
+	// state before the first key of a batch of queued keys
+	struct screen_state s;
+	struct timeval batch_start;
+	bool batching = false;
+	struct buffer *b;
+
+	init_event_loop();
 	while (editor_status == EDITOR_RUNNING) {
 		if (resized) {
 			resize();
+		} else if (!term_input_pending() && (b = find_loading_buffer())) {
+			// loading continues whenever there are no keys to handle
+			load_step(b);
 		} else {
 			unsigned int key;
 			enum term_key_type type;
+
+			if (!term_input_pending() && !wait_for_input())
+				continue;
 			if (term_read_key(&key, &type)) {
-				struct screen_state s;
 				clear_error();
-				save_state(&s);
-				modes[input_mode]->keypress(type, key);
-				if (input_mode == INPUT_GIT_OPEN) {
-					modes[input_mode]->update();
+				if (!batching) {
+					save_state(&s);
+					gettimeofday(&batch_start, NULL);
+					batching = true;
+				}
+				if (buffer->loader && input_mode == INPUT_NORMAL && type == KEY_NORMAL && key == CTRL('C')) {
+					cancel_loading(buffer);
+					info_msg("Loading cancelled.");
 				} else {
-					sanity_check();
-					update_screen(&s);
+					modes[input_mode]->keypress(type, key);
+				}
+				if (editor_status == EDITOR_RUNNING && !resized &&
+				    term_input_pending() &&
+				    elapsed_ms(&batch_start) < INPUT_LATENCY_BUDGET_MS) {
+					// nobody would see this frame but scroll
+					// the view as if it had been drawn
+					if (input_mode != INPUT_GIT_OPEN) {
+						update_cursor_x();
+						update_cursor_y();
+						update_view();
+					}
+					frames_skipped++;
+					continue;
 				}
+				update_after_event(&s);
+				batching = false;
 			}
 		}
 	}
@@ -24,6 +24,7 @@ extern char *charset;
 extern bool child_controls_terminal;
 extern bool resized;
 extern int cmdline_x;
+extern unsigned long frames_skipped;
 
 extern const char *program;
 extern const char *version;
@@ -33,10 +34,15 @@ char *editor_file(const char *name);
 char get_confirmation(const char *choices, const char *format, ...) FORMAT(2);
 void any_key(void);
 void normal_update(void);
+void update_progress(void);
 void resize(void);
 void ui_end(void);
 void suspend(void);
 void set_signal_handler(int signum, void (*handler)(int));
+void watch_fd(int fd, void (*callback)(int fd));
+void unwatch_fd(int fd);
+void set_timer(long ms, void (*callback)(void));
+void wake_main_loop(void);
 void main_loop(void);
 
 #endif
@@ -15,6 +15,14 @@ static void expand_file(struct gbuf *buf)
 		gbuf_add_str(buf, buffer->abs_filename);
 }
 
+static void expand_frames_skipped(struct gbuf *buf)
+{
+	char tmp[32];
+
+	snprintf(tmp, sizeof(tmp), "%lu", frames_skipped);
+	gbuf_add_str(buf, tmp);
+}
+
 static void expand_pkgdatadir(struct gbuf *buf)
 {
 	gbuf_add_str(buf, pkgdatadir);
@@ -37,6 +45,7 @@ static void expand_word(struct gbuf *buf)
 
 static const struct builtin_env builtin[] = {
 	{ "FILE",	expand_file },
+	{ "FRAMES_SKIPPED",	expand_frames_skipped },
 	{ "PKGDATADIR",	expand_pkgdatadir },
 	{ "WORD",	expand_word },
 };
@@ -0,0 +1,320 @@
+#include "follow.h"
+#include "editor.h"
+#include "load-save.h"
+#include "window.h"
+#include "block.h"
+#include "col-index.h"
+#include "change.h"
+#include "journal.h"
+#include "mark.h"
+#include "error.h"
+#include "fork.h"
+#include "words.h"
+
+#include <sys/inotify.h>
+
+/*
+ * Buffers with the follow option set are watched with inotify. When the
+ * file grows the new lines are appended to the end of the buffer like
+ * "tail -f" does. Appending is not an undoable change.
+ *
+ * Log rotation moves or deletes the file and creates a new one with the
+ * same name. The watch is then moved to the new file, or to the directory
+ * until the new file appears, and the buffer is read again from the start.
+ */
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+static int inotify_fd = -1;
+static PTR_ARRAY(followed);
+
+static void read_follow_events(int fd);
+
+static void follow_buffer(struct buffer *b)
+{
+	if (!b->abs_filename) {
+		error_msg("Can't follow a file without filename.");
+		b->options.follow = 0;
+		return;
+	}
+	if (inotify_fd < 0) {
+		inotify_fd = inotify_init();
+		if (inotify_fd < 0) {
+			error_msg("inotify_init: %s", strerror(errno));
+			b->options.follow = 0;
+			return;
+		}
+		close_on_exec(inotify_fd);
+		fcntl(inotify_fd, F_SETFL, O_NONBLOCK);
+		watch_fd(inotify_fd, read_follow_events);
+	}
+	b->follow_wd = inotify_add_watch(inotify_fd, b->abs_filename, FILE_EVENTS);
+	if (b->follow_wd < 0) {
+		error_msg("Can't follow %s: %s", b->abs_filename, strerror(errno));
+		b->follow_wd = 0;
+		b->options.follow = 0;
+		return;
+	}
+	// buffer contains the file as it was when it was loaded or saved
+	b->follow_offset = b->st.st_size;
+	ptr_array_add(&followed, b);
+}
+
+// watches of a directory are shared by files in it
+static void release_watch(struct buffer *b, int wd)
+{
+	int i;
+
+	for (i = 0; i < followed.count; i++) {
+		struct buffer *f = followed.ptrs[i];
+
+		if (f != b && (f->follow_wd == wd || f->follow_dir_wd == wd))
+			return;
+	}
+	inotify_rm_watch(inotify_fd, wd);
+}
+
+void unfollow_buffer(struct buffer *b)
+{
+	if (!b->follow_wd)
+		return;
+
+	if (b->follow_wd > 0)
+		release_watch(b, b->follow_wd);
+	if (b->follow_dir_wd)
+		release_watch(b, b->follow_dir_wd);
+	b->follow_wd = 0;
+	b->follow_dir_wd = 0;
+	ptr_array_remove(&followed, ptr_array_idx(&followed, b));
+}
+
+void follow_changed(void)
+{
+	if (buffer->options.follow) {
+		if (!buffer->follow_wd)
+			follow_buffer(buffer);
+	} else {
+		unfollow_buffer(buffer);
+	}
+}
+
+// returns size of complete lines
+static ssize_t read_new_lines(struct buffer *b, int fd, char **bufp)
+{
+	ssize_t size = b->st.st_size - b->follow_offset;
+	char *buf = xnew(char, size);
+
+	size = xread(fd, buf, size);
+	while (size > 0 && buf[size - 1] != '\n')
+		size--;
+	if (size <= 0) {
+		// wait until the rest of the line has been written
+		free(buf);
+		return 0;
+	}
+	*bufp = buf;
+	return size;
+}
+
+// file was truncated, lines are read again from the beginning of the file
+static void clear_followed(struct buffer *b)
+{
+	bool indexed = b->words_indexed;
+	struct list_head *item;
+	long size = 0;
+	int i;
+
+	unindex_buffer_words(b);
+	block_forget_anchor();
+	col_index_forget(b);
+	item = b->blocks.next;
+	while (item != &b->blocks) {
+		struct list_head *next = item->next;
+		struct block *blk = BLOCK(item);
+
+		size += blk->size;
+		free(blk->data);
+		free(blk);
+		item = next;
+	}
+	list_init(&b->blocks);
+	list_add_before(&block_new(1)->node, &b->blocks);
+	b->nl = 0;
+	b->follow_offset = 0;
+
+	if (b->marks.count)
+		update_marks(b, 0, size, 0);
+	for (i = 0; i < b->views.count; i++) {
+		struct view *v = b->views.ptrs[i];
+
+		v->cursor.head = &b->blocks;
+		v->cursor.blk = BLOCK(b->blocks.next);
+		v->cursor.offset = 0;
+		v->vx = v->vy = 0;
+		if (v == v->window->view && b != buffer)
+			mark_everything_changed();
+	}
+	// old changes and journal records refer to the old contents
+	forget_changes(b);
+	journal_discard(b);
+	if (indexed)
+		index_buffer_words(b);
+
+	if (b->line_start_states.count > 1)
+		b->line_start_states.count = 1;
+	b->changed_line_min = 0;
+	b->changed_line_max = INT_MAX;
+}
+
+// called when the followed file has been modified
+void append_new_lines(struct buffer *b)
+{
+	struct ptr_array *s = &b->line_start_states;
+	long *offsets, old_size = 0;
+	long old_nl = b->nl;
+	struct block *blk;
+	ssize_t size;
+	char *buf;
+	int fd, i;
+
+	fd = open(b->abs_filename, O_RDONLY);
+	if (fd < 0)
+		return;
+	fstat(fd, &b->st);
+	if (b->st.st_size < b->follow_offset) {
+		info_msg("%s was truncated.", buffer_filename(b));
+		clear_followed(b);
+	}
+	if (lseek(fd, b->follow_offset, SEEK_SET) < 0) {
+		close(fd);
+		return;
+	}
+	size = read_new_lines(b, fd, &buf);
+	close(fd);
+	if (!size)
+		return;
+
+	// cursors at EOF move with the appended text
+	list_for_each_entry(blk, &b->blocks, node)
+		old_size += blk->size;
+	offsets = xnew(long, b->views.count);
+	for (i = 0; i < b->views.count; i++) {
+		struct view *v = b->views.ptrs[i];
+		offsets[i] = block_iter_get_offset(&v->cursor);
+	}
+
+	if (append_lines(b, (unsigned char *)buf, size)) {
+		free(offsets);
+		free(buf);
+		return;
+	}
+	b->follow_offset += size;
+	free(buf);
+	add_appended_words(b, old_size);
+
+	for (i = 0; i < b->views.count; i++) {
+		struct view *v = b->views.ptrs[i];
+
+		if (offsets[i] == old_size) {
+			block_iter_eof(&v->cursor);
+		} else {
+			block_iter_goto_offset(&v->cursor, offsets[i]);
+		}
+		if (v == v->window->view && b != buffer)
+			mark_everything_changed();
+	}
+	free(offsets);
+
+	// Only the new lines need to be highlighted. Start state of the
+	// first new line is still valid, states after it don't exist.
+	if (s->count > old_nl + 1)
+		s->count = old_nl + 1;
+	if (old_nl < b->changed_line_min)
+		b->changed_line_min = old_nl;
+	b->changed_line_max = INT_MAX;
+}
+
+// the file was moved or deleted, or a file was created in its directory
+static void rewatch_followed(struct buffer *b)
+{
+	int old_wd = b->follow_wd;
+	int wd = inotify_add_watch(inotify_fd, b->abs_filename, FILE_EVENTS);
+
+	if (wd == old_wd)
+		return;
+	if (wd < 0) {
+		// wait for the file to be created again
+		if (!b->follow_dir_wd) {
+			char *dir = xstrdup(b->abs_filename);
+
+			*strrchr(dir, '/') = 0;
+			b->follow_dir_wd = inotify_add_watch(inotify_fd, *dir ? dir : "/", DIR_EVENTS);
+			if (b->follow_dir_wd < 0)
+				b->follow_dir_wd = 0;
+			free(dir);
+		}
+		// -1 is never a watch but keeps the buffer followed
+		wd = -1;
+	}
+	b->follow_wd = wd;
+	if (old_wd > 0)
+		release_watch(b, old_wd);
+	if (wd < 0)
+		return;
+
+	if (b->follow_dir_wd) {
+		int dir_wd = b->follow_dir_wd;
+
+		b->follow_dir_wd = 0;
+		release_watch(b, dir_wd);
+	}
+	info_msg("%s was replaced.", buffer_filename(b));
+	clear_followed(b);
+	append_new_lines(b);
+}
+
+static bool is_followed_name(struct buffer *b, const struct inotify_event *ev)
+{
+	const char *slash = strrchr(b->abs_filename, '/');
+
+	return ev->len && streq(ev->name, slash + 1);
+}
+
+static void handle_follow_event(const struct inotify_event *ev)
+{
+	int i;
+
+	for (i = 0; i < followed.count; i++) {
+		struct buffer *b = followed.ptrs[i];
+
+		if (buffer_incomplete(b))
+			continue;
+		if (b->follow_wd == ev->wd) {
+			if (ev->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF))
+				rewatch_followed(b);
+			else
+				append_new_lines(b);
+		} else if (b->follow_dir_wd == ev->wd && is_followed_name(b, ev)) {
+			rewatch_followed(b);
+		}
+	}
+}
+
+static void read_follow_events(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		ssize_t pos = 0;
+
+		while (pos < len) {
+			struct inotify_event *ev = (struct inotify_event *)(buf + pos);
+
+			// file size is compared so extra events are harmless
+			handle_follow_event(ev);
+			pos += sizeof(*ev) + ev->len;
+		}
+	}
+}
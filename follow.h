@@ -0,0 +1,10 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include "buffer.h"
+
+void follow_changed(void);
+void unfollow_buffer(struct buffer *b);
+void append_new_lines(struct buffer *b);
+
+#endif
@@ -3,6 +3,7 @@
 #include "uchar.h"
 #include "editor.h"
 #include "input-special.h"
+#include "load-save.h"
 #include "selection.h"
 
 struct formatter {
@@ -121,7 +122,11 @@ void format_status(char *buf, int size, const char *format)
 					add_status_str(&f, "*");
 				break;
 			case 'r':
-				if (buffer->ro)
+				if (buffer->loader)
+					add_status_format(&f, "Loading %d%%", loading_progress(buffer));
+				else if (buffer->partial)
+					add_status_str(&f, "Partial");
+				else if (buffer->ro)
 					add_status_str(&f, "RO");
 				break;
 			case 'y':
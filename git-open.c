@@ -8,15 +8,87 @@
 #include "modes.h"
 #include "screen.h"
 #include "uchar.h"
+#include "fork.h"
+
+#include <sys/mman.h>
+
+/*
+ * A file matches if every word of the query matches its name. A word
+ * matches if its characters are found in the name in the same order.
+ * Consecutive characters and matches in the basename or at the beginning
+ * of a path component or a word inside it score more and the best
+ * matches are listed first.
+ *
+ * Typing more of the query can only drop files so the files which
+ * matched the previous query are filtered again instead of all files.
+ * Filtering many files is split between forked workers which write
+ * their matches to shared memory.
+ */
+
+#define SCORE_CHAR 1
+#define BONUS_CONSECUTIVE 4
+#define BONUS_BOUNDARY 8
+#define BONUS_BASENAME 2
+
+#define MAX_WORKERS 8
+// forking costs more than filtering fewer files
+#define MIN_WORKER_FILES (64 * 1024)
+
+struct file_entry {
+	char *name;
+	// characters in name, see char_mask()
+	unsigned long long mask;
+	int len;
+	// offset of the basename
+	int base;
+};
+
+struct match {
+	long idx;
+	int score;
+};
+
+struct query {
+	struct ptr_array words;
+	int *lens;
+	// words with non-ASCII characters, see unicode_word_score()
+	bool *unicode;
+	// characters of ASCII words
+	unsigned long long mask;
+	bool icase;
+};
+
+// written by a worker to the beginning of the shared memory
+struct worker_result {
+	long count;
+	int max_score;
+};
 
 struct git_open git_open;
 
+// all files in git ls-files order
+static struct file_entry *entries;
+static long nr_entries;
+
+// files matching match_query
+static char *match_query;
+static struct match *matches;
+static long nr_matches;
+
 static void git_open_clear(void)
 {
 	free(git_open.all_files);
 	git_open.all_files = NULL;
 	git_open.size = 0;
 	git_open.files.count = 0;
+	free(entries);
+	entries = NULL;
+	nr_entries = 0;
+	free(match_query);
+	match_query = NULL;
+	free(matches);
+	matches = NULL;
+	nr_matches = 0;
 	git_open.selected = 0;
 	git_open.scroll = 0;
 }
@@ -41,6 +113,68 @@ static char *cdup(void)
 	return NULL;
 }
 
+static int char_bit(unsigned char ch)
+{
+	if (isalpha(ch))
+		return to_lower(ch) - 'a';
+	if (isdigit(ch))
+		return ch - '0' + 26;
+	switch (ch) {
+	case '.':
+		return 36;
+	case '_':
+		return 37;
+	case '-':
+		return 38;
+	}
+	return -1;
+}
+
+/*
+ * Letters are folded to lower case so the mask of a name must contain
+ * the mask of every word that can match it.
+ */
+static unsigned long long char_mask(const char *str, long len)
+{
+	unsigned long long mask = 0;
+	long i;
+
+	for (i = 0; i < len; i++) {
+		int bit = char_bit(str[i]);
+
+		if (bit >= 0)
+			mask |= 1ULL << bit;
+	}
+	return mask;
+}
+
+static void add_entries(void)
+{
+	char *ptr = git_open.all_files;
+	char *end = git_open.all_files + git_open.size;
+	long alloc = 0;
+
+	while (ptr < end) {
+		char *zero = memchr(ptr, 0, end - ptr);
+		struct file_entry *e;
+		char *slash;
+
+		if (zero == NULL)
+			break;
+		if (nr_entries == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			xrenew(entries, alloc);
+		}
+		e = &entries[nr_entries++];
+		e->name = ptr;
+		e->len = zero - ptr;
+		slash = strrchr(ptr, '/');
+		e->base = slash ? slash - ptr + 1 : 0;
+		e->mask = char_mask(ptr, e->len);
+		ptr = zero + 1;
+	}
+}
+
 static void git_open_load(void)
 {
 	static const char *cmd[] = { "git", "ls-files", "-z", NULL, NULL };
@@ -54,6 +188,7 @@ static void git_open_load(void)
 	if (spawn_filter((char **)cmd, &data) == 0) {
 		git_open.all_files = data.out;
 		git_open.size = data.out_len;
+		add_entries();
 	} else {
 		git_open.all_files = NULL;
 		git_open.size = 0;
@@ -88,26 +223,261 @@ static void split(struct ptr_array *words, const char *str)
 	}
 }
 
-static bool words_match(const char *name, struct ptr_array *words)
+static bool is_boundary(const char *name, int i)
 {
-	int i;
+	char prev;
 
-	for (i = 0; i < words->count; i++) {
-		if (!strstr(name, words->ptrs[i]))
-			return false;
+	if (i == 0)
+		return true;
+	prev = name[i - 1];
+	if (prev == '/' || prev == '_' || prev == '-' || prev == '.' || prev == ' ')
+		return true;
+	// camelCase
+	return islower(prev) && isupper(name[i]);
+}
+
+// word is lowercase if icase is true
+static bool char_matches(char ch, char w, bool icase)
+{
+	return ch == w || (icase && to_lower(ch) == w);
+}
+
+// returns -1 if word does not match
+static int word_score(const struct file_entry *e, const char *word, int len, bool icase)
+{
+	const char *name = e->name;
+	char first = word[0];
+	char first_upper = icase ? to_upper(first) : first;
+	int i, j, next, score, best = -1;
+
+	for (i = 0; i + len <= e->len; i++) {
+		if (name[i] != first && name[i] != first_upper)
+			continue;
+		for (j = 1; j < len && char_matches(name[i + j], word[j], icase); j++)
+			;
+		if (j < len)
+			continue;
+
+		score = len * SCORE_CHAR + (len - 1) * BONUS_CONSECUTIVE;
+		if (is_boundary(name, i))
+			score += BONUS_BOUNDARY;
+		if (i >= e->base) {
+			score += len * BONUS_BASENAME;
+			if (i == e->base && (i + len == e->len || name[i + len] == '.')) {
+				// whole basename, possibly without extension
+				score += BONUS_BOUNDARY;
+			}
+		}
+		if (score > best)
+			best = score;
 	}
-	return true;
+	if (best >= 0 || len == 1)
+		return best;
+
+	// characters are not consecutive, match from the end to prefer basename
+	score = 0;
+	next = -1;
+	j = len - 1;
+	for (i = e->len - 1; i >= 0 && j >= 0; i--) {
+		if (!char_matches(name[i], word[j], icase))
+			continue;
+		score += SCORE_CHAR;
+		if (is_boundary(name, i))
+			score += BONUS_BOUNDARY;
+		if (i >= e->base)
+			score += BONUS_BASENAME;
+		if (i + 1 == next)
+			score += BONUS_CONSECUTIVE;
+		next = i;
+		j--;
+	}
+	return j < 0 ? score : -1;
 }
 
-static bool words_match_icase(const char *name, struct ptr_array *words)
+/*
+ * Characters of a word with non-ASCII characters must be consecutive in
+ * the name. Case is folded like in u_str_index() so that for example "ä"
+ * matches "Ä".
+ */
+static int unicode_word_score(const struct file_entry *e, const char *word, bool icase)
 {
-	int i;
+	long i = 0, pos = 0;
+	int nr_chars = 0, best = -1;
 
-	for (i = 0; i < words->count; i++) {
-		if (u_str_index(name, words->ptrs[i]) < 0)
-			return false;
+	while (word[i]) {
+		u_str_get_char(word, &i);
+		nr_chars++;
 	}
-	return true;
+	while (pos < e->len) {
+		const char *found;
+		int score;
+
+		if (icase) {
+			int idx = u_str_index(e->name + pos, word);
+			found = idx < 0 ? NULL : e->name + pos + idx;
+		} else {
+			found = strstr(e->name + pos, word);
+		}
+		if (!found)
+			break;
+		pos = found - e->name;
+
+		score = nr_chars * SCORE_CHAR + (nr_chars - 1) * BONUS_CONSECUTIVE;
+		if (is_boundary(e->name, pos))
+			score += BONUS_BOUNDARY;
+		if (pos >= e->base)
+			score += nr_chars * BONUS_BASENAME;
+		if (score > best)
+			best = score;
+		u_str_get_char(e->name, &pos);
+	}
+	return best;
+}
+
+static int file_score(const struct file_entry *e, const struct query *q)
+{
+	int i, total = 0;
+
+	for (i = 0; i < q->words.count; i++) {
+		const char *word = q->words.ptrs[i];
+		int score;
+
+		if (q->unicode[i])
+			score = unicode_word_score(e, word, q->icase);
+		else
+			score = word_score(e, word, q->lens[i], q->icase);
+		if (score < 0)
+			return -1;
+		total += score;
+	}
+	return total;
+}
+
+// files from[start..end) or entries[start..end) if from is NULL
+static long filter_range(const struct query *q, const struct match *from, long start, long end,
+	struct match *out, int *max_score)
+{
+	long i, nr = 0;
+
+	for (i = start; i < end; i++) {
+		long idx = from ? from[i].idx : i;
+		const struct file_entry *e = &entries[idx];
+		int score;
+
+		// cheap test before looking for the words
+		if ((e->mask & q->mask) != q->mask)
+			continue;
+		score = file_score(e, q);
+		if (score < 0)
+			continue;
+		if (score > *max_score)
+			*max_score = score;
+		out[nr].idx = idx;
+		out[nr].score = score;
+		nr++;
+	}
+	return nr;
+}
+
+/*
+ * The first part of the files is filtered here while every other part is
+ * filtered by a worker which writes the result and the matches to its own
+ * part of the shared memory. Parts which could not be filtered by a
+ * worker are filtered here too.
+ */
+static long filter_files(const struct query *q, const struct match *from, long count,
+	struct match *out, int *max_score)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int pids[MAX_WORKERS];
+	struct worker_result *results;
+	long part, size, nr = 0;
+	int i, nr_workers;
+	char *shm;
+
+	nr_workers = count / MIN_WORKER_FILES;
+	if (nr_workers > nr_cpus)
+		nr_workers = nr_cpus;
+	if (nr_workers > MAX_WORKERS)
+		nr_workers = MAX_WORKERS;
+	if (nr_workers < 2)
+		return filter_range(q, from, 0, count, out, max_score);
+
+	part = (count + nr_workers - 1) / nr_workers;
+	size = sizeof(*results) * MAX_WORKERS + sizeof(*out) * count;
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		return filter_range(q, from, 0, count, out, max_score);
+	results = (struct worker_result *)shm;
+
+	for (i = 1; i < nr_workers; i++) {
+		long start = i * part;
+		long end = start + part < count ? start + part : count;
+
+		pids[i] = fork();
+		if (!pids[i]) {
+			struct match *m = (struct match *)(results + MAX_WORKERS) + start;
+
+			results[i].max_score = 0;
+			results[i].count = filter_range(q, from, start, end, m, &results[i].max_score);
+			_exit(0);
+		}
+	}
+	nr = filter_range(q, from, 0, part, out, max_score);
+	for (i = 1; i < nr_workers; i++) {
+		long start = i * part;
+		long end = start + part < count ? start + part : count;
+		struct match *m = (struct match *)(results + MAX_WORKERS) + start;
+
+		if (pids[i] > 0 && !wait_child(pids[i])) {
+			memcpy(out + nr, m, results[i].count * sizeof(*m));
+			nr += results[i].count;
+			if (results[i].max_score > *max_score)
+				*max_score = results[i].max_score;
+		} else {
+			nr += filter_range(q, from, start, end, out + nr, max_score);
+		}
+	}
+	munmap(shm, size);
+	return nr;
+}
+
+/*
+ * Matches are in file order. Sorting them by length and then by score
+ * with stable counting sorts gives best first, shortest first and then
+ * file order in time linear to the number of matches.
+ */
+#define MAX_SORT_LEN 1024
+
+static void sort_matches(struct match *m, long count, int max_score)
+{
+	struct match *tmp = xnew(struct match, count);
+	long *pos = xnew0(long, (max_score > MAX_SORT_LEN ? max_score : MAX_SORT_LEN) + 2);
+	long i;
+
+	for (i = 0; i < count; i++) {
+		int len = entries[m[i].idx].len;
+
+		pos[(len < MAX_SORT_LEN ? len : MAX_SORT_LEN) + 1]++;
+	}
+	for (i = 1; i <= MAX_SORT_LEN; i++)
+		pos[i] += pos[i - 1];
+	for (i = 0; i < count; i++) {
+		int len = entries[m[i].idx].len;
+
+		tmp[pos[len < MAX_SORT_LEN ? len : MAX_SORT_LEN]++] = m[i];
+	}
+
+	memset(pos, 0, (max_score + 2) * sizeof(*pos));
+	for (i = 0; i < count; i++)
+		pos[max_score - tmp[i].score + 1]++;
+	for (i = 1; i <= max_score; i++)
+		pos[i] += pos[i - 1];
+	for (i = 0; i < count; i++)
+		m[pos[max_score - tmp[i].score]++] = tmp[i];
+
+	free(pos);
+	free(tmp);
 }
 
 static const char *selected_file(void)
@@ -117,29 +487,59 @@ static const char *selected_file(void)
 	return git_open.files.ptrs[git_open.selected];
 }
 
+static bool is_ascii(const char *str)
+{
+	while (*str) {
+		if (!isascii(*str++))
+			return false;
+	}
+	return true;
+}
+
 static void git_open_filter(void)
 {
 	char *str = cmdline.buf.buffer;
-	char *ptr = git_open.all_files;
-	char *end = git_open.all_files + git_open.size;
-	bool (*match)(const char *, struct ptr_array *) = words_match_icase;
-	PTR_ARRAY(words);
+	bool refine = match_query && str_has_prefix(str, match_query);
+	long i, count = refine ? nr_matches : nr_entries;
+	struct match *new = xnew(struct match, count + 1);
+	struct match *sorted;
+	struct query q;
+	long nr_new;
+	int max_score = 0;
 
-	// NOTE: words_match_icase() requires str to be lowercase
-	if (contains_upper(str))
-		match = words_match;
-	split(&words, str);
+	clear(&q);
+	q.icase = !contains_upper(str);
+	split(&q.words, str);
+	q.lens = xnew(int, q.words.count + 1);
+	q.unicode = xnew(bool, q.words.count + 1);
+	for (i = 0; i < q.words.count; i++) {
+		q.lens[i] = strlen(q.words.ptrs[i]);
+		q.unicode[i] = !is_ascii(q.words.ptrs[i]);
+		if (!q.unicode[i])
+			q.mask |= char_mask(q.words.ptrs[i], q.lens[i]);
+	}
+	nr_new = filter_files(&q, refine ? matches : NULL, count, new, &max_score);
+	ptr_array_free(&q.words);
+	free(q.lens);
+	free(q.unicode);
 
-	git_open.files.count = 0;
-	while (ptr < end) {
-		char *zero = memchr(ptr, 0, end - ptr);
-		if (zero == NULL)
-			break;
-		if (match(ptr, &words))
-			ptr_array_add(&git_open.files, ptr);
-		ptr = zero + 1;
+	free(matches);
+	matches = new;
+	nr_matches = nr_new;
+	free(match_query);
+	match_query = xstrdup(str);
+
+	// matches stay in file order for the next query
+	sorted = matches;
+	if (max_score) {
+		sorted = xmemdup(matches, nr_matches * sizeof(*matches));
+		sort_matches(sorted, nr_matches, max_score);
 	}
-	ptr_array_free(&words);
+	git_open.files.count = 0;
+	for (i = 0; i < nr_matches; i++)
+		ptr_array_add(&git_open.files, entries[sorted[i].idx].name);
+	if (sorted != matches)
+		free(sorted);
 	git_open.selected = 0;
 	git_open.scroll = 0;
 }
@@ -241,7 +641,8 @@ static void git_open_update(void)
 	buf_hide_cursor();
 	update_term_title();
 	update_git_open();
-	buf_move_cursor(cmdline_x, 0);
+	buf_flush_cells();
+	buf_move_term_cursor(cmdline_x, 0);
 	buf_show_cursor();
 	buf_flush();
 }
@@ -0,0 +1,798 @@
+#include "indexer.h"
+#include "ctags.h"
+#include "editor.h"
+#include "error.h"
+#include "fork.h"
+#include "path.h"
+#include "common.h"
+#include "ctype.h"
+
+/*
+ * Built-in replacement for ctags. Definitions are found by a line based
+ * scanner which knows just enough of C, Go and Python to find functions,
+ * types and macros. Files are scanned by worker processes in parallel
+ * and the output is in tags file format so that lookups work exactly like
+ * with a real tags file.
+ *
+ * A saved file is scanned again. Its new tags are kept separately and
+ * hide the old ones until there are enough of them to be worth merging
+ * into the indexed tags.
+ */
+
+#define MAX_WORKERS 8
+#define MAX_PENDING 64
+#define WORKER_BUF_SIZE (64 * 1024)
+
+enum lang {
+	LANG_NONE,
+	LANG_C,
+	LANG_GO,
+	LANG_PYTHON,
+};
+
+struct scanner {
+	struct gbuf *out;
+	const char *filename;
+	const char *buf;
+	long size;
+	long line;
+	bool in_comment;
+};
+
+struct worker {
+	int pid;
+	int fd;
+	struct gbuf output;
+};
+
+struct pending_file {
+	char *filename;
+	struct tag_file tf;
+};
+
+// absolute path of the directory filenames are relative to, ends with '/'
+static char *index_dir;
+// absolute paths of indexed directories, end with '/'
+static PTR_ARRAY(index_roots);
+// the same directories as filenames of their tags start, "" for "."
+static PTR_ARRAY(root_prefixes);
+
+static struct tag_file symbols;
+static char *symbols_index;
+static PTR_ARRAY(pending);
+
+// child process which sorts the tags, see build_index()
+static int index_pid;
+static struct gbuf index_buf = GBUF_INIT;
+
+static struct worker workers[MAX_WORKERS];
+static int nr_workers;
+static int nr_running;
+static long nr_indexed_files;
+static struct gbuf collected = GBUF_INIT;
+
+static enum lang file_lang(const char *filename)
+{
+	static const struct {
+		const char *ext;
+		enum lang lang;
+	} exts[] = {
+		{ "c", LANG_C },
+		{ "cc", LANG_C },
+		{ "cpp", LANG_C },
+		{ "cxx", LANG_C },
+		{ "h", LANG_C },
+		{ "hh", LANG_C },
+		{ "hpp", LANG_C },
+		{ "go", LANG_GO },
+		{ "py", LANG_PYTHON },
+	};
+	const char *ext = strrchr(filename, '.');
+	int i;
+
+	if (!ext || strchr(ext, '/'))
+		return LANG_NONE;
+	for (i = 0; i < ARRAY_COUNT(exts); i++) {
+		if (streq(ext + 1, exts[i].ext))
+			return exts[i].lang;
+	}
+	return LANG_NONE;
+}
+
+static void add_tag(struct scanner *s, const char *name, long len, char kind, bool local)
+{
+	char tail[64];
+
+	gbuf_add_buf(s->out, name, len);
+	gbuf_add_ch(s->out, '\t');
+	gbuf_add_str(s->out, s->filename);
+	snprintf(tail, sizeof(tail), "\t%ld;\"\t%c%s\n", s->line, kind, local ? "\tfile:" : "");
+	gbuf_add_str(s->out, tail);
+}
+
+static void skip_space(const char *line, long len, long *pos)
+{
+	while (*pos < len && (line[*pos] == ' ' || line[*pos] == '\t'))
+		(*pos)++;
+}
+
+static long word_len(const char *line, long len, long pos)
+{
+	long i = pos;
+
+	if (i < len && isdigit(line[i]))
+		return 0;
+	while (i < len && is_word_byte(line[i]))
+		i++;
+	return i - pos;
+}
+
+// skip word and spaces after it
+static bool match_word(const char *line, long len, long *pos, const char *word)
+{
+	long n = strlen(word);
+
+	if (word_len(line, len, *pos) != n || memcmp(line + *pos, word, n))
+		return false;
+	*pos += n;
+	skip_space(line, len, pos);
+	return true;
+}
+
+// add tag if there is a name at pos
+static bool add_word(struct scanner *s, const char *line, long len, long pos, char kind, bool local)
+{
+	long n = word_len(line, len, pos);
+
+	if (n)
+		add_tag(s, line + pos, n, kind, local);
+	return n;
+}
+
+static void c_comments(struct scanner *s, const char *line, long len)
+{
+	long i;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (s->in_comment) {
+			if (line[i] == '*' && line[i + 1] == '/') {
+				s->in_comment = false;
+				i++;
+			}
+		} else if (line[i] == '/' && line[i + 1] == '*') {
+			s->in_comment = true;
+			i++;
+		} else if (line[i] == '/' && line[i + 1] == '/') {
+			break;
+		}
+	}
+}
+
+// parenthesis at paren is followed by function body
+static bool c_body_follows(struct scanner *s, long paren)
+{
+	long end = paren + 4096 < s->size ? paren + 4096 : s->size;
+	long i, depth = 0;
+
+	for (i = paren; i < end; i++) {
+		char ch = s->buf[i];
+
+		if (ch == '(') {
+			depth++;
+		} else if (ch == ')') {
+			if (!--depth)
+				break;
+		} else if (ch == ';' || ch == '{' || ch == '}') {
+			return false;
+		}
+	}
+	// skip whitespace and qualifiers such as const
+	for (i++; i < end; i++) {
+		if (!isspace(s->buf[i]) && !is_word_byte(s->buf[i]))
+			break;
+	}
+	return i < end && s->buf[i] == '{';
+}
+
+static char c_type_kind(const char *line, long len, long *pos)
+{
+	if (match_word(line, len, pos, "struct"))
+		return 's';
+	if (match_word(line, len, pos, "union"))
+		return 'u';
+	if (match_word(line, len, pos, "enum"))
+		return 'g';
+	return 0;
+}
+
+static void scan_c_line(struct scanner *s, const char *line, long len)
+{
+	bool in_comment = s->in_comment;
+	const char *paren;
+	long pos = 0;
+	bool local;
+	char kind;
+
+	c_comments(s, line, len);
+	if (in_comment || !len)
+		return;
+
+	if (line[0] == '#') {
+		pos = 1;
+		skip_space(line, len, &pos);
+		if (match_word(line, len, &pos, "define"))
+			add_word(s, line, len, pos, 'd', false);
+		return;
+	}
+	if (line[0] == '}') {
+		// end of typedef struct
+		long n;
+
+		pos = 1;
+		skip_space(line, len, &pos);
+		n = word_len(line, len, pos);
+		if (n && pos + n < len && line[pos + n] == ';')
+			add_tag(s, line + pos, n, 't', false);
+		return;
+	}
+	if (!is_word_byte(line[0]))
+		return;
+
+	local = match_word(line, len, &pos, "static");
+	if (match_word(line, len, &pos, "typedef")) {
+		const char *ptr = memchr(line, '(', len);
+		long end = len;
+
+		if (ptr && ptr + 1 < line + len && ptr[1] == '*') {
+			// typedef int (*name)(void);
+			add_word(s, line, len, ptr - line + 2, 't', false);
+			return;
+		}
+		kind = c_type_kind(line, len, &pos);
+		if (kind && memchr(line, '{', len)) {
+			add_word(s, line, len, pos, kind, false);
+			return;
+		}
+		while (end > 0 && isspace(line[end - 1]))
+			end--;
+		if (end > 0 && line[end - 1] == ';') {
+			// name is the last word
+			pos = --end;
+			while (pos > 0 && is_word_byte(line[pos - 1]))
+				pos--;
+			add_word(s, line, end, pos, 't', false);
+		}
+		return;
+	}
+
+	paren = memchr(line, '(', len);
+	if (paren) {
+		long end = paren - line;
+
+		while (end > 0 && (line[end - 1] == ' ' || line[end - 1] == '\t'))
+			end--;
+		pos = end;
+		while (pos > 0 && is_word_byte(line[pos - 1]))
+			pos--;
+		if (pos < end && c_body_follows(s, paren - s->buf))
+			add_word(s, line, end, pos, 'f', local);
+		return;
+	}
+
+	kind = c_type_kind(line, len, &pos);
+	if (kind) {
+		// struct name { or brace on the next line
+		long name = pos;
+		long n = word_len(line, len, pos);
+
+		pos += n;
+		skip_space(line, len, &pos);
+		if (n && (pos == len || line[pos] == '{'))
+			add_tag(s, line + name, n, kind, false);
+	}
+}
+
+static void scan_go_line(struct scanner *s, const char *line, long len)
+{
+	long pos = 0;
+
+	if (match_word(line, len, &pos, "func")) {
+		if (pos < len && line[pos] == '(') {
+			// method, skip receiver
+			const char *end = memchr(line + pos, ')', len - pos);
+
+			if (!end)
+				return;
+			pos = end - line + 1;
+			skip_space(line, len, &pos);
+		}
+		add_word(s, line, len, pos, 'f', false);
+	} else if (match_word(line, len, &pos, "type")) {
+		add_word(s, line, len, pos, 't', false);
+	} else if (match_word(line, len, &pos, "const")) {
+		add_word(s, line, len, pos, 'c', false);
+	} else if (match_word(line, len, &pos, "var")) {
+		add_word(s, line, len, pos, 'v', false);
+	}
+}
+
+static void scan_python_line(struct scanner *s, const char *line, long len)
+{
+	long pos = 0;
+
+	skip_space(line, len, &pos);
+	match_word(line, len, &pos, "async");
+	if (match_word(line, len, &pos, "def"))
+		add_word(s, line, len, pos, line[0] == ' ' || line[0] == '\t' ? 'm' : 'f', false);
+	else if (match_word(line, len, &pos, "class"))
+		add_word(s, line, len, pos, 'c', false);
+}
+
+// append tags found in buf to out in tags file format
+void scan_tags(const char *filename, const char *buf, long size, struct gbuf *out)
+{
+	void (*scan_line)(struct scanner *s, const char *line, long len);
+	struct scanner s;
+	long pos = 0;
+
+	switch (file_lang(filename)) {
+	case LANG_C:
+		scan_line = scan_c_line;
+		break;
+	case LANG_GO:
+		scan_line = scan_go_line;
+		break;
+	case LANG_PYTHON:
+		scan_line = scan_python_line;
+		break;
+	default:
+		return;
+	}
+
+	clear(&s);
+	s.out = out;
+	s.filename = filename;
+	s.buf = buf;
+	s.size = size;
+	while (pos < size) {
+		const char *line = buf + pos;
+		const char *end = memchr(line, '\n', size - pos);
+		long len = end ? end - line : size - pos;
+
+		pos += len + 1;
+		if (len && line[len - 1] == '\r')
+			len--;
+		s.line++;
+		scan_line(&s, line, len);
+	}
+}
+
+static void file_type(const char *path, const struct dirent *de, bool *is_dir, bool *is_reg)
+{
+	mode_t type = dirent_type(de);
+	struct stat st;
+
+	if (!type && !lstat(path, &st))
+		type = st.st_mode & S_IFMT;
+	*is_dir = type == S_IFDIR;
+	*is_reg = type == S_IFREG;
+}
+
+// dir is empty or ends with '/'
+static void find_files(const char *dir, struct ptr_array *files)
+{
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(*dir ? dir : ".");
+	if (!d)
+		return;
+	while ((de = readdir(d))) {
+		bool is_dir, is_reg;
+		char *path;
+
+		if (de->d_name[0] == '.')
+			continue;
+		path = xsprintf("%s%s", dir, de->d_name);
+		file_type(path, de, &is_dir, &is_reg);
+		if (is_dir) {
+			char *sub = xsprintf("%s/", path);
+
+			find_files(sub, files);
+			free(sub);
+		} else if (is_reg && file_lang(path) != LANG_NONE) {
+			ptr_array_add(files, path);
+			continue;
+		}
+		free(path);
+	}
+	closedir(d);
+}
+
+static NORETURN void run_worker(int fd, struct ptr_array *files, int first, int step)
+{
+	struct gbuf out = GBUF_INIT;
+	int i;
+
+	for (i = first; i < files->count; i += step) {
+		const char *filename = files->ptrs[i];
+		char *buf;
+		long size = read_file(filename, &buf);
+
+		if (size > 0)
+			scan_tags(filename, buf, size, &out);
+		free(buf);
+		if (out.len >= WORKER_BUF_SIZE) {
+			if (xwrite(fd, out.buffer, out.len) < 0)
+				_exit(1);
+			gbuf_clear(&out);
+		}
+	}
+	if (out.len && xwrite(fd, out.buffer, out.len) < 0)
+		_exit(1);
+	_exit(0);
+}
+
+static void index_output(int fd)
+{
+	ssize_t rc;
+	int status;
+	long size;
+
+	gbuf_grow(&index_buf, WORKER_BUF_SIZE);
+	rc = read(fd, index_buf.buffer + index_buf.len, WORKER_BUF_SIZE);
+	if (rc < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (rc > 0) {
+		index_buf.len += rc;
+		return;
+	}
+
+	unwatch_fd(fd);
+	close(fd);
+	status = wait_child(index_pid);
+	index_pid = 0;
+	size = index_buf.len;
+	symbols_index = gbuf_steal(&index_buf);
+	if (status || !set_tag_index(&symbols, symbols_index, size)) {
+		// lookups keep scanning all tags
+		free(symbols_index);
+		symbols_index = NULL;
+	}
+}
+
+/*
+ * Sorting the tags takes too long to do in the editor process. Lookups
+ * scan all tags until the index has been built by a child process.
+ */
+static void build_index(void)
+{
+	int fd[2];
+
+	free(symbols_index);
+	symbols_index = NULL;
+	symbols.index = NULL;
+	if (!symbols.size || pipe_close_on_exec(fd))
+		return;
+	index_pid = fork();
+	if (index_pid < 0) {
+		index_pid = 0;
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	}
+	if (!index_pid) {
+		long size;
+		char *buf;
+
+		close(fd[0]);
+		buf = build_tag_index(&symbols, &size);
+		_exit(xwrite(fd[1], buf, size) < 0);
+	}
+	close(fd[1]);
+	gbuf_clear(&index_buf);
+	watch_fd(fd[0], index_output);
+}
+
+static void free_pending(void)
+{
+	int i;
+
+	for (i = 0; i < pending.count; i++) {
+		struct pending_file *p = pending.ptrs[i];
+
+		free(p->filename);
+		free(p->tf.map);
+		free(p);
+	}
+	pending.count = 0;
+}
+
+static void indexing_done(void)
+{
+	const char *p, *end;
+	long nr_tags = 0;
+
+	free(symbols.map);
+	symbols.size = collected.len;
+	symbols.map = gbuf_steal(&collected);
+	build_index();
+	end = symbols.map + symbols.size;
+	for (p = symbols.map; (p = memchr(p, '\n', end - p)); p++)
+		nr_tags++;
+	info_msg("Indexed %ld tags in %ld files.", nr_tags, nr_indexed_files);
+}
+
+static void worker_output(int fd)
+{
+	struct worker *w = NULL;
+	ssize_t rc;
+	int i, status;
+
+	for (i = 0; i < nr_workers; i++) {
+		if (workers[i].fd == fd)
+			w = &workers[i];
+	}
+
+	gbuf_grow(&w->output, WORKER_BUF_SIZE);
+	rc = read(fd, w->output.buffer + w->output.len, WORKER_BUF_SIZE);
+	if (rc < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (rc > 0) {
+		w->output.len += rc;
+		return;
+	}
+
+	unwatch_fd(fd);
+	close(fd);
+	w->fd = -1;
+	status = wait_child(w->pid);
+	if (status)
+		error_msg("Tag indexer failed.");
+	gbuf_add_buf(&collected, w->output.buffer, w->output.len);
+	gbuf_free(&w->output);
+	if (!--nr_running)
+		indexing_done();
+}
+
+static void start_workers(struct ptr_array *files)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	nr_workers = nr_cpus < 1 ? 1 : nr_cpus > MAX_WORKERS ? MAX_WORKERS : nr_cpus;
+	for (i = 0; i < nr_workers; i++) {
+		struct worker *w = &workers[i];
+		int fd[2];
+
+		w->fd = -1;
+		gbuf_init(&w->output);
+		if (pipe_close_on_exec(fd))
+			continue;
+		w->pid = fork();
+		if (w->pid < 0) {
+			close(fd[0]);
+			close(fd[1]);
+			continue;
+		}
+		if (!w->pid) {
+			close(fd[0]);
+			run_worker(fd[1], files, i, nr_workers);
+		}
+		close(fd[1]);
+		w->fd = fd[0];
+		watch_fd(w->fd, worker_output);
+		nr_running++;
+	}
+	if (!nr_running)
+		error_msg("Could not start tag indexer: %s", strerror(errno));
+}
+
+static char *dir_path(const char *dir)
+{
+	char *abs = path_absolute(dir);
+	char *path;
+	int len;
+
+	if (!abs)
+		abs = xstrdup(dir);
+	len = strlen(abs);
+	if (len && abs[len - 1] == '/')
+		len--;
+	path = xsprintf("%.*s/", len, abs);
+	free(abs);
+	return path;
+}
+
+void index_tags(char **dirs)
+{
+	static char dot[] = ".";
+	static char *default_dirs[] = { dot, NULL };
+	PTR_ARRAY(files);
+	int i;
+
+	if (nr_running || index_pid) {
+		error_msg("Indexing is already in progress.");
+		return;
+	}
+	if (!dirs[0])
+		dirs = default_dirs;
+
+	free(index_dir);
+	index_dir = dir_path(".");
+	ptr_array_free(&index_roots);
+	ptr_array_free(&root_prefixes);
+	free_pending();
+	for (i = 0; dirs[i]; i++) {
+		char *dir;
+
+		if (streq(dirs[i], ".")) {
+			dir = xstrdup("");
+		} else {
+			int len = strlen(dirs[i]);
+
+			while (len > 1 && dirs[i][len - 1] == '/')
+				len--;
+			dir = xsprintf("%.*s/", len, dirs[i]);
+		}
+		ptr_array_add(&index_roots, dir_path(dirs[i]));
+		find_files(dir, &files);
+		ptr_array_add(&root_prefixes, dir);
+	}
+
+	nr_indexed_files = files.count;
+	gbuf_clear(&collected);
+	if (files.count)
+		start_workers(&files);
+	else
+		indexing_done();
+	ptr_array_free(&files);
+}
+
+static bool is_pending(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < pending.count; i++) {
+		struct pending_file *p = pending.ptrs[i];
+
+		if (streq(p->filename, filename))
+			return true;
+	}
+	return false;
+}
+
+// move tags of saved files to the indexed tags
+static void merge_pending(void)
+{
+	struct gbuf buf = GBUF_INIT;
+	char *prev = NULL;
+	bool skip = false;
+	long pos = 0;
+	int i;
+
+	while (pos < symbols.size) {
+		const char *line = symbols.map + pos;
+		const char *end = memchr(line, '\n', symbols.size - pos);
+		long len = end ? end - line + 1 : symbols.size - pos;
+		const char *file = memchr(line, '\t', len);
+
+		pos += len;
+		if (!file)
+			continue;
+		file++;
+		end = memchr(file, '\t', line + len - file);
+		if (!end)
+			continue;
+		// tags of one file are next to each other
+		if (!prev || strlen(prev) != end - file || memcmp(prev, file, end - file)) {
+			free(prev);
+			prev = xstrslice(file, 0, end - file);
+			skip = is_pending(prev);
+		}
+		if (!skip)
+			gbuf_add_buf(&buf, line, len);
+	}
+	free(prev);
+	for (i = 0; i < pending.count; i++) {
+		struct pending_file *p = pending.ptrs[i];
+
+		gbuf_add_buf(&buf, p->tf.map, p->tf.size);
+	}
+	free_pending();
+
+	free(symbols.map);
+	symbols.size = buf.len;
+	symbols.map = gbuf_steal(&buf);
+	build_index();
+}
+
+void reindex_file(const char *abs_filename)
+{
+	struct pending_file *p = NULL;
+	struct gbuf out = GBUF_INIT;
+	char *filename, *buf;
+	long size;
+	int i;
+
+	if (!index_dir || file_lang(abs_filename) == LANG_NONE)
+		return;
+	for (i = 0; i < index_roots.count; i++) {
+		if (str_has_prefix(abs_filename, index_roots.ptrs[i]))
+			break;
+	}
+	if (i == index_roots.count)
+		return;
+	// same name the file got when its directory was indexed
+	filename = xsprintf("%s%s", (char *)root_prefixes.ptrs[i],
+		abs_filename + strlen(index_roots.ptrs[i]));
+
+	size = read_file(abs_filename, &buf);
+	if (size > 0)
+		scan_tags(filename, buf, size, &out);
+	free(buf);
+
+	for (i = 0; i < pending.count; i++) {
+		p = pending.ptrs[i];
+		if (streq(p->filename, filename))
+			break;
+	}
+	if (i == pending.count) {
+		p = xnew0(struct pending_file, 1);
+		p->filename = filename;
+		ptr_array_add(&pending, p);
+	} else {
+		free(filename);
+	}
+	free(p->tf.map);
+	p->tf.size = out.len;
+	p->tf.map = gbuf_steal(&out);
+
+	if (pending.count > MAX_PENDING && !nr_running && !index_pid)
+		merge_pending();
+}
+
+static void add_tag_result(struct ptr_array *tags, struct tag *t)
+{
+	// filenames are relative to the directory where indexing started
+	// unless an absolute directory was indexed
+	if (t->filename[0] != '/') {
+		char *filename = xsprintf("%s%s", index_dir, t->filename);
+
+		free(t->filename);
+		t->filename = filename;
+	}
+	ptr_array_add(tags, t);
+}
+
+bool find_indexed_tags(const char *prefix, int exact, struct ptr_array *tags)
+{
+	struct tag *t;
+	size_t pos = 0;
+	int i;
+
+	if (!index_dir)
+		return false;
+
+	t = xnew(struct tag, 1);
+	while (symbols.map && next_tag(&symbols, &pos, prefix, exact, t)) {
+		// old tags of a saved file
+		if (is_pending(t->filename)) {
+			free_tag(t);
+			continue;
+		}
+		add_tag_result(tags, t);
+		t = xnew(struct tag, 1);
+	}
+	for (i = 0; i < pending.count; i++) {
+		struct pending_file *p = pending.ptrs[i];
+
+		pos = 0;
+		while (next_tag(&p->tf, &pos, prefix, exact, t)) {
+			add_tag_result(tags, t);
+			t = xnew(struct tag, 1);
+		}
+	}
+	free(t);
+	return true;
+}
@@ -0,0 +1,13 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include "libc.h"
+#include "gbuf.h"
+#include "ptr-array.h"
+
+void scan_tags(const char *filename, const char *buf, long size, struct gbuf *out);
+void index_tags(char **dirs);
+void reindex_file(const char *abs_filename);
+bool find_indexed_tags(const char *prefix, int exact, struct ptr_array *tags);
+
+#endif
@@ -1,4 +1,5 @@
 #include "iter.h"
+#include "common.h"
 
 #include <string.h>
 
@@ -197,16 +198,83 @@ void block_iter_goto_line(struct block_iter *bi, long line)
 	}
 }
 
-long block_iter_get_offset(const struct block_iter *bi)
-{
+/*
+ * Offset of a block is found by walking the block list. Start of the
+ * block where the buffer was last edited is remembered and the walk
+ * starts from there in both directions so that a series of edits close
+ * to each other (:replace, undoing a change chain) doesn't walk the
+ * whole list for every edit.
+ *
+ * Blocks before the anchor must not change and the anchor block must not
+ * be freed, see block_forget_anchor().
+ */
+static struct {
+	struct list_head *head;
 	struct block *blk;
-	long offset = 0;
+	long offset;
+	long nl;
+} anchor;
 
-	list_for_each_entry(blk, bi->head, node) {
-		if (blk == bi->blk)
-			break;
-		offset += blk->size;
+void block_set_anchor(const struct block_iter *bi, long offset, long nl)
+{
+	anchor.head = bi->head;
+	anchor.blk = bi->blk;
+	anchor.offset = offset;
+	anchor.nl = nl;
+}
+
+void block_forget_anchor(void)
+{
+	anchor.head = NULL;
+}
+
+// offset and line number of the first byte of bi->blk
+void block_start_position(const struct block_iter *bi, long *offset, long *nl)
+{
+	struct block *fwd = BLOCK(bi->head->next);
+	struct block *bwd = NULL;
+	long fwd_offset = 0, fwd_nl = 0;
+	long bwd_offset = 0, bwd_nl = 0;
+
+	if (anchor.head == bi->head) {
+		fwd = bwd = anchor.blk;
+		fwd_offset = bwd_offset = anchor.offset;
+		fwd_nl = bwd_nl = anchor.nl;
 	}
+	while (1) {
+		if (fwd == bi->blk) {
+			*offset = fwd_offset;
+			*nl = fwd_nl;
+			return;
+		}
+		if (bwd == bi->blk) {
+			*offset = bwd_offset;
+			*nl = bwd_nl;
+			return;
+		}
+		if (fwd && fwd->node.next != bi->head) {
+			fwd_offset += fwd->size;
+			fwd_nl += fwd->nl;
+			fwd = BLOCK(fwd->node.next);
+		} else {
+			fwd = NULL;
+		}
+		if (bwd && bwd->node.prev != bi->head) {
+			bwd = BLOCK(bwd->node.prev);
+			bwd_offset -= bwd->size;
+			bwd_nl -= bwd->nl;
+		} else {
+			bwd = NULL;
+		}
+		BUG_ON(!fwd && !bwd);
+	}
+}
+
+long block_iter_get_offset(const struct block_iter *bi)
+{
+	long offset, nl;
+
+	block_start_position(bi, &offset, &nl);
 	return offset + bi->offset;
 }
 
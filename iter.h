@@ -59,6 +59,9 @@ void block_iter_skip_bytes(struct block_iter *bi, long count);
 void block_iter_goto_offset(struct block_iter *bi, long offset);
 void block_iter_goto_line(struct block_iter *bi, long line);
 long block_iter_get_offset(const struct block_iter *bi);
+void block_start_position(const struct block_iter *bi, long *offset, long *nl);
+void block_set_anchor(const struct block_iter *bi, long offset, long nl);
+void block_forget_anchor(void);
 
 bool block_iter_is_bol(const struct block_iter *bi);
 
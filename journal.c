@@ -0,0 +1,274 @@
+#include "journal.h"
+#include "change.h"
+#include "editor.h"
+#include "error.h"
+#include "gbuf.h"
+#include "fork.h"
+
+/*
+ * Changes to a buffer are appended to ~/.dex/journal/HASH so that unsaved
+ * work can be recovered if the editor gets killed. Writing a record costs
+ * only as much as the change itself, unlike saving the whole file.
+ *
+ * File format:
+ *
+ *     "dex-journal SIZE MTIME FILENAME\n"
+ *     (struct journal_record, deleted bytes, inserted bytes)...
+ *
+ * SIZE and MTIME are taken from the saved file the records apply to.
+ * Records are collected in memory and written and fsync()ed a moment
+ * after the first unwritten change so that typing doesn't cause an
+ * fsync() for every key.
+ */
+
+#define FLUSH_DELAY_MS 1000
+
+struct journal {
+	char *filename;
+	int fd;
+	struct gbuf pending;
+};
+
+struct journal_record {
+	long offset;
+	long del_count;
+	long ins_count;
+};
+
+static PTR_ARRAY(journals);
+
+// don't record changes made while replaying the journal
+static bool replaying;
+
+static char *journal_filename(const char *abs_filename)
+{
+	// FNV-1a
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	char *dir, *filename;
+	int i;
+
+	for (i = 0; abs_filename[i]; i++) {
+		hash ^= (unsigned char)abs_filename[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	dir = editor_file("journal");
+	filename = xsprintf("%s/%016llx", dir, hash);
+	free(dir);
+	return filename;
+}
+
+// truncate the file to keep bytes or start a new journal if keep is 0
+static struct journal *open_journal(struct buffer *b, long keep)
+{
+	char *filename = journal_filename(b->abs_filename);
+	struct journal *j;
+	int fd;
+
+	if (!keep) {
+		char *dir = editor_file("journal");
+		mkdir(dir, 0700);
+		free(dir);
+	}
+
+	fd = open(filename, O_CREAT | O_WRONLY | (keep ? 0 : O_TRUNC), 0600);
+	if (fd < 0) {
+		error_msg("Error creating journal %s: %s", filename, strerror(errno));
+		free(filename);
+		return NULL;
+	}
+	if (keep && (ftruncate(fd, keep) || lseek(fd, 0, SEEK_END) < 0)) {
+		error_msg("Error truncating journal %s: %s", filename, strerror(errno));
+		close(fd);
+		free(filename);
+		return NULL;
+	}
+	close_on_exec(fd);
+
+	j = xnew(struct journal, 1);
+	j->filename = filename;
+	j->fd = fd;
+	gbuf_init(&j->pending);
+	if (!keep) {
+		char *header = xsprintf("dex-journal %lld %lld %s\n",
+			(long long)b->st.st_size,
+			(long long)b->st.st_mtime,
+			b->abs_filename);
+		gbuf_add_str(&j->pending, header);
+		free(header);
+	}
+	ptr_array_add(&journals, j);
+	b->journal = j;
+	return j;
+}
+
+static void close_journal(struct buffer *b)
+{
+	struct journal *j = b->journal;
+
+	ptr_array_remove(&journals, ptr_array_idx(&journals, j));
+	close(j->fd);
+	free(j->filename);
+	gbuf_free(&j->pending);
+	free(j);
+	b->journal = NULL;
+}
+
+void journal_record(long offset, const char *deleted, long del_count, const char *inserted, long ins_count)
+{
+	struct journal *j = buffer->journal;
+	struct journal_record r;
+
+	if (replaying || !buffer->options.journal || !buffer->abs_filename)
+		return;
+
+	if (!j) {
+		j = open_journal(buffer, 0);
+		if (!j) {
+			// don't complain about every single change
+			buffer->options.journal = 0;
+			return;
+		}
+	}
+
+	r.offset = offset;
+	r.del_count = del_count;
+	r.ins_count = ins_count;
+	gbuf_add_buf(&j->pending, (const char *)&r, sizeof(r));
+	gbuf_add_buf(&j->pending, deleted, del_count);
+	gbuf_add_buf(&j->pending, inserted, ins_count);
+	set_timer(FLUSH_DELAY_MS, journal_flush);
+}
+
+void journal_flush(void)
+{
+	int i;
+
+	for (i = 0; i < journals.count; i++) {
+		struct journal *j = journals.ptrs[i];
+
+		if (!j->pending.len)
+			continue;
+		if (xwrite(j->fd, j->pending.buffer, j->pending.len) < 0 || fsync(j->fd))
+			error_msg("Error writing journal %s: %s", j->filename, strerror(errno));
+		gbuf_clear(&j->pending);
+	}
+}
+
+static long buffer_size(void)
+{
+	struct block *blk;
+	long size = 0;
+
+	list_for_each_entry(blk, &buffer->blocks, node)
+		size += blk->size;
+	return size;
+}
+
+static bool apply_record(const struct journal_record *r, const char *data, long *size)
+{
+	bool ok = true;
+
+	if (r->offset < 0 || r->del_count < 0 || r->ins_count < 0)
+		return false;
+	if (!r->del_count && !r->ins_count)
+		return false;
+	if (r->offset + r->del_count > *size)
+		return false;
+
+	block_iter_goto_offset(&view->cursor, r->offset);
+	if (r->del_count) {
+		// make sure the record applies to the same text
+		char *deleted = buffer_get_bytes(r->del_count);
+		ok = !memcmp(deleted, data, r->del_count);
+		free(deleted);
+	}
+	if (ok) {
+		buffer_replace_bytes(r->del_count, data + r->del_count, r->ins_count);
+		*size += r->ins_count - r->del_count;
+	}
+	return ok;
+}
+
+/*
+ * Re-apply changes from a journal left behind by an editor that did not
+ * exit cleanly. The journal is used only if the file on disk is still
+ * the one the journal was written for.
+ */
+void journal_replay(void)
+{
+	char *filename, *buf, *nl;
+	long long file_size, file_mtime;
+	long size, pos, bsize, count = 0;
+	int n = 0;
+
+	if (buffer_incomplete(buffer)) {
+		// called again when loading has finished, see set_view()
+		buffer->journal_pending = true;
+		return;
+	}
+	buffer->journal_pending = false;
+	if (!buffer->options.journal || !buffer->abs_filename || buffer->journal)
+		return;
+
+	filename = journal_filename(buffer->abs_filename);
+	size = read_file(filename, &buf);
+	if (size <= 0) {
+		free(filename);
+		return;
+	}
+
+	nl = memchr(buf, '\n', size);
+	if (!nl)
+		goto stale;
+	*nl = 0;
+	if (sscanf(buf, "dex-journal %lld %lld %n", &file_size, &file_mtime, &n) != 2 || !n)
+		goto stale;
+	if (!streq(buf + n, buffer->abs_filename))
+		goto stale;
+	if (file_size != buffer->st.st_size || file_mtime != buffer->st.st_mtime)
+		goto stale;
+
+	pos = nl - buf + 1;
+	bsize = buffer_size();
+	replaying = true;
+	begin_change_chain();
+	while (pos + (long)sizeof(struct journal_record) <= size) {
+		struct journal_record r;
+		long data = pos + sizeof(r);
+
+		memcpy(&r, buf + pos, sizeof(r));
+		if (r.del_count > size - data || r.ins_count > size - data - r.del_count) {
+			// torn write
+			break;
+		}
+		if (!apply_record(&r, buf + data, &bsize))
+			break;
+		pos = data + r.del_count + r.ins_count;
+		count++;
+	}
+	end_change_chain();
+	replaying = false;
+
+	if (count)
+		info_msg("Recovered %ld unsaved changes from journal.", count);
+
+	// continue appending after the last valid record
+	open_journal(buffer, pos);
+	free(buf);
+	free(filename);
+	return;
+stale:
+	unlink(filename);
+	free(buf);
+	free(filename);
+}
+
+// called after the buffer has been saved or is going to be freed
+void journal_discard(struct buffer *b)
+{
+	if (!b->journal)
+		return;
+	unlink(b->journal->filename);
+	close_journal(b);
+}
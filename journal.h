@@ -0,0 +1,11 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "buffer.h"
+
+void journal_record(long offset, const char *deleted, long del_count, const char *inserted, long ins_count);
+void journal_flush(void);
+void journal_replay(void);
+void journal_discard(struct buffer *b);
+
+#endif
@@ -9,6 +9,7 @@
 #include "encoding.h"
 #include "error.h"
 #include "cconv.h"
+#include "col-index.h"
 
 #include <sys/mman.h>
 
@@ -41,12 +42,28 @@ copy:
 	return blk;
 }
 
-static int decode_and_add_blocks(struct buffer *b, const unsigned char *buf, size_t size)
+/*
+ * Files bigger than this are decoded in steps between reading keys so
+ * that the beginning of the file can be viewed while the rest is loaded.
+ */
+#define PROGRESSIVE_LOAD_SIZE (16 * 1024 * 1024)
+
+// bytes of input to decode before the file is first displayed
+#define FIRST_LOAD_STEP (256 * 1024)
+#define LOAD_STEP (2 * 1024 * 1024)
+
+struct file_loader {
+	struct file_decoder *dec;
+	unsigned char *buf;
+	size_t size;
+
+	// encoding was not given or found from BOM
+	bool detect_encoding;
+};
+
+static struct file_decoder *new_decoder(struct buffer *b, const unsigned char *buf, size_t size)
 {
 	const char *e = detect_encoding_from_bom(buf, size);
-	struct file_decoder *dec;
-	char *line;
-	ssize_t len;
 
 	if (b->encoding == NULL) {
 		if (e) {
@@ -86,37 +103,121 @@ static int decode_and_add_blocks(struct buffer *b, const unsigned char *buf, siz
 		size -= bom_len;
 	}
 
-	dec = new_file_decoder(b->encoding, buf, size);
-	if (dec == NULL)
-		return -1;
+	return new_file_decoder(b->encoding, buf, size);
+}
+
+/*
+ * Decode lines until at least max bytes of input have been consumed.
+ * Lines are added to blk first if it is not NULL. Returns false if there
+ * is nothing more to decode.
+ */
+static bool decode_lines(struct buffer *b, struct file_decoder *dec, struct block *blk, ssize_t max)
+{
+	ssize_t end = dec->ipos + max;
+	bool more = false;
+	char *line;
+	ssize_t len;
 
-	if (file_decoder_read_line(dec, &line, &len)) {
-		struct block *blk = NULL;
+	// last block may be reallocated
+	col_index_forget(b);
 
-		if (len && line[len - 1] == '\r') {
-			b->newline = NEWLINE_DOS;
-			len--;
+	while (file_decoder_read_line(dec, &line, &len)) {
+		if (!blk && list_empty(&b->blocks)) {
+			// first line
+			if (len && line[len - 1] == '\r')
+				b->newline = NEWLINE_DOS;
 		}
+		if (b->newline == NEWLINE_DOS && len && line[len - 1] == '\r')
+			len--;
 		blk = add_utf8_line(b, blk, line, len);
-
-		while (file_decoder_read_line(dec, &line, &len)) {
-			if (b->newline == NEWLINE_DOS && len && line[len - 1] == '\r')
-				len--;
-			blk = add_utf8_line(b, blk, line, len);
+		if (dec->ipos >= end) {
+			more = true;
+			break;
 		}
-		if (blk)
-			add_block(b, blk);
-	}
-	if (b->encoding == NULL) {
-		e = dec->encoding;
-		if (e == NULL)
-			e = charset;
-		b->encoding = xstrdup(e);
 	}
+	if (blk)
+		add_block(b, blk);
+	return more;
+}
+
+static void set_decoded_encoding(struct buffer *b, struct file_decoder *dec)
+{
+	const char *e = dec->encoding;
+
+	if (e == NULL)
+		e = charset;
+	b->encoding = xstrdup(e);
+}
+
+static int decode_and_add_blocks(struct buffer *b, const unsigned char *buf, size_t size)
+{
+	struct file_decoder *dec = new_decoder(b, buf, size);
+
+	if (dec == NULL)
+		return -1;
+
+	while (decode_lines(b, dec, NULL, size))
+		;
+	if (b->encoding == NULL)
+		set_decoded_encoding(b, dec);
 	free_file_decoder(dec);
 	return 0;
 }
 
+static int start_loading(struct buffer *b, unsigned char *buf, size_t size)
+{
+	struct file_loader *l;
+	struct file_decoder *dec = new_decoder(b, buf, size);
+
+	if (dec == NULL)
+		return -1;
+
+	l = xnew(struct file_loader, 1);
+	l->dec = dec;
+	l->buf = buf;
+	l->size = size;
+	l->detect_encoding = b->encoding == NULL;
+	b->loader = l;
+
+	decode_lines(b, dec, NULL, FIRST_LOAD_STEP);
+	if (l->detect_encoding) {
+		// good enough for displaying until the whole file is decoded
+		set_decoded_encoding(b, dec);
+	}
+	return 0;
+}
+
+static void free_loader(struct buffer *b)
+{
+	struct file_loader *l = b->loader;
+
+	free_file_decoder(l->dec);
+	munmap(l->buf, l->size);
+	free(l);
+	b->loader = NULL;
+}
+
+static void add_final_newline(struct buffer *b)
+{
+	if (list_empty(&b->blocks)) {
+		struct block *blk = block_new(1);
+		list_add_before(&blk->node, &b->blocks);
+	} else {
+		// Incomplete lines are not allowed because they are
+		// special cases and cause lots of trouble.
+		struct block *blk = BLOCK(b->blocks.prev);
+		if (blk->size && blk->data[blk->size - 1] != '\n') {
+			if (blk->size == blk->alloc) {
+				blk->alloc = ROUND_UP(blk->size + 1, 64);
+				xrenew(blk->data, blk->alloc);
+			}
+			blk->data[blk->size++] = '\n';
+			blk->nl++;
+			b->nl++;
+		}
+	}
+}
+
 static int read_blocks(struct buffer *b, int fd)
 {
 	size_t size = b->st.st_size;
@@ -136,6 +237,12 @@ static int read_blocks(struct buffer *b, int fd)
 			mapped = true;
 		}
 	}
+	if (mapped && size >= PROGRESSIVE_LOAD_SIZE) {
+		rc = start_loading(b, buf, size);
+		if (rc)
+			munmap(buf, size);
+		return rc;
+	}
 	if (!mapped) {
 		ssize_t alloc = map_size;
 		ssize_t pos = 0;
@@ -208,29 +315,82 @@ int load_buffer(struct buffer *b, bool must_exist, const char *filename)
 			b->ro = true;
 		}
 	}
-	if (list_empty(&b->blocks)) {
-		struct block *blk = block_new(1);
-		list_add_before(&blk->node, &b->blocks);
-	} else {
-		// Incomplete lines are not allowed because they are
-		// special cases and cause lots of trouble.
-		struct block *blk = BLOCK(b->blocks.prev);
-		if (blk->size && blk->data[blk->size - 1] != '\n') {
-			if (blk->size == blk->alloc) {
-				blk->alloc = ROUND_UP(blk->size + 1, 64);
-				xrenew(blk->data, blk->alloc);
-			}
-			blk->data[blk->size++] = '\n';
-			blk->nl++;
-			b->nl++;
-		}
+	if (b->loader) {
+		// rest of the file is loaded by load_more()
+		return 0;
 	}
+	add_final_newline(b);
 
 	if (b->encoding == NULL)
 		b->encoding = xstrdup(charset);
 	return 0;
 }
 
+/*
+ * Decode next part of a file being loaded. Returns false when the
+ * whole file has been loaded.
+ */
+bool load_more(struct buffer *b)
+{
+	struct file_loader *l = b->loader;
+
+	if (decode_lines(b, l->dec, NULL, LOAD_STEP))
+		return true;
+
+	if (l->detect_encoding) {
+		free(b->encoding);
+		set_decoded_encoding(b, l->dec);
+	}
+	free_loader(b);
+	add_final_newline(b);
+	return false;
+}
+
+// stop loading, the rest of the file is not needed
+void cancel_loading(struct buffer *b)
+{
+	free_loader(b);
+	add_final_newline(b);
+	b->partial = true;
+}
+
+/*
+ * Append complete lines read from the file to the end of buffer. The last
+ * block is freed if the buffer was empty so caller must reset iterators.
+ */
+int append_lines(struct buffer *b, const unsigned char *buf, size_t size)
+{
+	struct file_decoder *dec = new_file_decoder(b->encoding, buf, size);
+	struct block *blk;
+
+	if (dec == NULL)
+		return -1;
+
+	// continue filling the last block
+	block_forget_anchor();
+	blk = BLOCK(b->blocks.prev);
+	list_del(&blk->node);
+	b->nl -= blk->nl;
+	if (!blk->size) {
+		// buffer was empty
+		free(blk->data);
+		free(blk);
+		blk = NULL;
+	}
+	while (decode_lines(b, dec, blk, size))
+		blk = NULL;
+	free_file_decoder(dec);
+	add_final_newline(b);
+	return 0;
+}
+
+int loading_progress(struct buffer *b)
+{
+	struct file_decoder *dec = b->loader->dec;
+
+	return (long long)dec->ipos * 100 / dec->isize;
+}
+
 static char *tmp_filename(const char *filename)
 {
 	int len = strlen(filename);
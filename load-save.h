@@ -4,6 +4,10 @@
 #include "buffer.h"
 
 int load_buffer(struct buffer *b, bool must_exist, const char *filename);
+bool load_more(struct buffer *b);
+void cancel_loading(struct buffer *b);
+int append_lines(struct buffer *b, const unsigned char *buf, size_t size);
+int loading_progress(struct buffer *b);
 int save_buffer(const char *filename, const char *encoding, enum newline_sequence newline);
 
 #endif
@@ -0,0 +1,163 @@
+#include "lz.h"
+
+#include <stdint.h>
+
+/*
+ * Simple LZ77 compressor for undo history. Speed matters more than
+ * compression ratio.
+ *
+ * Compressed data is a series of sequences:
+ *
+ *     token, [literal length], literals, offset, [match length]
+ *
+ * High 4 bits of token is number of literals and low 4 bits number of
+ * bytes to copy minus MIN_MATCH. Value 15 means the length continues in
+ * following bytes, each of which is added to it until a byte is not 255.
+ * Offset is 2 bytes, little endian. The last sequence contains only
+ * literals.
+ */
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static uint32_t read32(const char *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static unsigned int hash32(uint32_t val)
+{
+	return (val * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static char *put_length(char *dst, long len)
+{
+	while (len >= 255) {
+		*dst++ = (char)255;
+		len -= 255;
+	}
+	*dst++ = len;
+	return dst;
+}
+
+static char *put_sequence(char *dst, const char *lit, long lit_len, long offset, long match_len)
+{
+	char *token = dst++;
+	int t;
+
+	t = lit_len < 15 ? lit_len : 15;
+	*token = t << 4;
+	if (t == 15)
+		dst = put_length(dst, lit_len - 15);
+	memcpy(dst, lit, lit_len);
+	dst += lit_len;
+
+	if (!match_len)
+		return dst;
+
+	*dst++ = offset & 0xff;
+	*dst++ = offset >> 8;
+	match_len -= MIN_MATCH;
+	t = match_len < 15 ? match_len : 15;
+	*token |= t;
+	if (t == 15)
+		dst = put_length(dst, match_len - 15);
+	return dst;
+}
+
+// dst must have room for lz_bound(len) bytes, returns size of compressed data
+long lz_compress(const char *src, long len, char *dst)
+{
+	long table[1 << HASH_BITS];
+	long pos = 0, anchor = 0;
+	char *start = dst;
+	int i;
+
+	for (i = 0; i < ARRAY_COUNT(table); i++)
+		table[i] = -1;
+
+	while (pos + MIN_MATCH <= len) {
+		uint32_t val = read32(src + pos);
+		unsigned int h = hash32(val);
+		long ref = table[h];
+		long match_len;
+
+		table[h] = pos;
+		if (ref < 0 || pos - ref > MAX_OFFSET || read32(src + ref) != val) {
+			pos++;
+			continue;
+		}
+
+		match_len = MIN_MATCH;
+		while (pos + match_len < len && src[ref + match_len] == src[pos + match_len])
+			match_len++;
+
+		dst = put_sequence(dst, src + anchor, pos - anchor, pos - ref, match_len);
+		pos += match_len;
+		anchor = pos;
+	}
+	dst = put_sequence(dst, src + anchor, len - anchor, 0, 0);
+	return dst - start;
+}
+
+static bool get_length(const unsigned char **srcp, const unsigned char *end, long *len)
+{
+	const unsigned char *src = *srcp;
+	unsigned int ch;
+
+	do {
+		if (src == end)
+			return false;
+		ch = *src++;
+		*len += ch;
+	} while (ch == 255);
+	*srcp = src;
+	return true;
+}
+
+// returns false if data is corrupted or doesn't decompress to len bytes
+bool lz_decompress(const char *src_, long size, char *dst, long len)
+{
+	const unsigned char *src = (const unsigned char *)src_;
+	const unsigned char *end = src + size;
+	long pos = 0;
+
+	while (src < end) {
+		unsigned int token = *src++;
+		long lit_len = token >> 4;
+		long match_len = token & 15;
+		long offset;
+
+		if (lit_len == 15 && !get_length(&src, end, &lit_len))
+			return false;
+		if (lit_len > end - src || lit_len > len - pos)
+			return false;
+		memcpy(dst + pos, src, lit_len);
+		src += lit_len;
+		pos += lit_len;
+
+		if (src == end)
+			break;
+
+		if (end - src < 2)
+			return false;
+		offset = src[0] | src[1] << 8;
+		src += 2;
+		if (match_len == 15 && !get_length(&src, end, &match_len))
+			return false;
+		match_len += MIN_MATCH;
+		if (!offset || offset > pos || match_len > len - pos)
+			return false;
+
+		// source and destination may overlap
+		while (match_len--) {
+			dst[pos] = dst[pos - offset];
+			pos++;
+		}
+	}
+	return pos == len;
+}
@@ -0,0 +1,15 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "libc.h"
+
+// worst case size of compressed data
+static inline long lz_bound(long len)
+{
+	return len + len / 255 + 16;
+}
+
+long lz_compress(const char *src, long len, char *dst);
+bool lz_decompress(const char *src, long size, char *dst, long len);
+
+#endif
@@ -10,6 +10,7 @@
 #include "file-history.h"
 #include "search.h"
 #include "error.h"
+#include "journal.h"
 
 #include <locale.h>
 #include <langinfo.h>
@@ -36,7 +37,8 @@ static const char *builtin_rc =
 "hi\n"
 // must initialize string options
 "set statusline-left \" %f%s%m%r%s%M\"\n"
-"set statusline-right \" %y,%X   %u   %E %n %t   %p \"\n";
+"set statusline-right \" %y,%X   %u   %E %n %t   %p \"\n"
+"set tag-files \"\"\n";
 
 static void handle_sigtstp(int signum)
 {
@@ -54,6 +56,7 @@ static void handle_sigcont(int signum)
 static void handle_sigwinch(int signum)
 {
 	resized = true;
+	wake_main_loop();
 }
 
 static void close_all_views(void)
@@ -222,6 +225,7 @@ int main(int argc, char *argv[])
 	}
 	resize();
 	main_loop();
+	journal_flush();
 	ui_end();
 	history_save(&command_history, command_history_filename);
 	history_save(&search_history, search_history_filename);
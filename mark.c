@@ -0,0 +1,159 @@
+#include "mark.h"
+#include "buffer.h"
+
+/*
+ * Marks of a buffer are kept sorted by offset and changes never reorder
+ * them. A change shifts all marks after it by the same amount, so instead
+ * of touching every mark the shift is added to a Fenwick tree indexed by
+ * position of the mark in the sorted array. Offset of a mark is its
+ * stored offset plus the sum of shifts up to its index.
+ *
+ * Adding or removing a mark moves the marks after it in the array anyway
+ * so the shifts are then applied to the stored offsets and the tree is
+ * freed until the next change.
+ */
+
+static long mark_delta(const struct buffer *b, long idx)
+{
+	long sum = 0;
+
+	for (idx++; idx > 0; idx -= idx & -idx)
+		sum += b->mark_deltas[idx];
+	return sum;
+}
+
+// shift marks at index idx and after it
+static void shift_marks(struct buffer *b, long idx, long delta)
+{
+	long n = b->marks.count;
+
+	if (!b->mark_deltas)
+		b->mark_deltas = xnew0(long, n + 1);
+	for (idx++; idx <= n; idx += idx & -idx)
+		b->mark_deltas[idx] += delta;
+}
+
+// store real offsets in the marks and forget the shifts
+static void flush_marks(struct buffer *b)
+{
+	long *d = b->mark_deltas;
+	long i, n = b->marks.count, sum = 0;
+
+	if (!d)
+		return;
+	// reverse of building the tree in linear time
+	for (i = n; i > 0; i--) {
+		long parent = i + (i & -i);
+
+		if (parent <= n)
+			d[parent] -= d[i];
+	}
+	for (i = 0; i < n; i++) {
+		struct mark *m = b->marks.ptrs[i];
+
+		sum += d[i + 1];
+		m->offset += sum;
+	}
+	free(d);
+	b->mark_deltas = NULL;
+}
+
+long mark_offset(const struct mark *m)
+{
+	if (!m->buffer || !m->buffer->mark_deltas)
+		return m->offset;
+	return m->offset + mark_delta(m->buffer, m->idx);
+}
+
+// index of first mark with offset greater than offset
+static long first_mark_after(struct buffer *b, long offset)
+{
+	long lo = 0, hi = b->marks.count;
+
+	while (lo < hi) {
+		long mid = (lo + hi) / 2;
+
+		if (mark_offset(b->marks.ptrs[mid]) <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void renumber_marks(struct buffer *b, long idx)
+{
+	for (; idx < b->marks.count; idx++) {
+		struct mark *m = b->marks.ptrs[idx];
+		m->idx = idx;
+	}
+}
+
+void mark_add(struct buffer *b, struct mark *m, long offset)
+{
+	long idx;
+
+	flush_marks(b);
+	idx = first_mark_after(b, offset);
+	m->buffer = b;
+	m->offset = offset;
+	ptr_array_insert(&b->marks, m, idx);
+	renumber_marks(b, idx);
+}
+
+void mark_remove(struct mark *m)
+{
+	struct buffer *b = m->buffer;
+
+	if (b) {
+		flush_marks(b);
+		ptr_array_remove(&b->marks, m->idx);
+		renumber_marks(b, m->idx);
+		m->buffer = NULL;
+	}
+}
+
+void mark_move(struct mark *m, long offset)
+{
+	struct buffer *b = m->buffer;
+
+	if (mark_offset(m) != offset) {
+		mark_remove(m);
+		mark_add(b, m, offset);
+	}
+}
+
+/*
+ * Called before del bytes at offset are replaced with ins bytes. Marks
+ * inside the deleted range are moved one by one, the rest take one
+ * O(log n) update.
+ */
+void update_marks(struct buffer *b, long offset, long del, long ins)
+{
+	long i = first_mark_after(b, offset);
+	long end = del ? first_mark_after(b, offset + del - 1) : i;
+
+	for (; i < end; i++) {
+		struct mark *m = b->marks.ptrs[i];
+		long delta = offset - mark_offset(m);
+
+		shift_marks(b, i, delta);
+		shift_marks(b, i + 1, -delta);
+	}
+	if (end < b->marks.count && ins != del)
+		shift_marks(b, end, ins - del);
+}
+
+// called when the buffer is freed
+void detach_marks(struct buffer *b)
+{
+	long i;
+
+	flush_marks(b);
+	for (i = 0; i < b->marks.count; i++) {
+		struct mark *m = b->marks.ptrs[i];
+		m->buffer = NULL;
+	}
+	free(b->marks.ptrs);
+	b->marks.count = 0;
+}
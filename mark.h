@@ -0,0 +1,29 @@
+#ifndef MARK_H
+#define MARK_H
+
+#include "libc.h"
+
+struct buffer;
+
+/*
+ * Position in a buffer which moves with the text when the buffer is
+ * changed. Text deleted around a mark moves it to the start of the
+ * deleted range and text inserted at a mark goes after it.
+ */
+struct mark {
+	// NULL after the buffer has been freed or the mark removed
+	struct buffer *buffer;
+	// use mark_offset(), changes may not have been applied to this
+	long offset;
+	// index in buffer->marks
+	long idx;
+};
+
+long mark_offset(const struct mark *m);
+void mark_add(struct buffer *b, struct mark *m, long offset);
+void mark_remove(struct mark *m);
+void mark_move(struct mark *m, long offset);
+void update_marks(struct buffer *b, long offset, long del, long ins);
+void detach_marks(struct buffer *b);
+
+#endif
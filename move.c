@@ -2,6 +2,7 @@
 #include "buffer.h"
 #include "indent.h"
 #include "uchar.h"
+#include "col-index.h"
 
 enum char_type {
 	CT_SPACE,
@@ -13,9 +14,10 @@ enum char_type {
 void move_to_preferred_x(int preferred_x)
 {
 	unsigned int tw = buffer->options.tab_width;
+	struct col_pos pos;
 	struct lineref lr;
-	long i = 0;
-	unsigned int x = 0;
+	long i;
+	unsigned int x;
 
 	view->preferred_x = preferred_x;
 
@@ -33,9 +35,11 @@ void move_to_preferred_x(int preferred_x)
 				return;
 			}
 		}
-		i = 0;
 	}
 
+	col_index_seek_col(&pos, lr.line, lr.size, false, view->preferred_x);
+	i = pos.offset;
+	x = pos.col;
 	while (x < view->preferred_x && i < lr.size) {
 		unsigned int u = lr.line[i++];
 
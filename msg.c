@@ -9,6 +9,9 @@ struct file_location {
 	char *filename;
 	unsigned int buffer_id;
 	int row, col;
+
+	// follows changes while the buffer is open
+	struct mark mark;
 };
 
 static PTR_ARRAY(file_locations);
@@ -24,9 +27,17 @@ static struct file_location *create_location(void)
 	loc->buffer_id = buffer->id;
 	loc->row = view->cy + 1;
 	loc->col = view->cx_char + 1;
+	mark_add(buffer, &loc->mark, block_iter_get_offset(&view->cursor));
 	return loc;
 }
 
+static void free_location(struct file_location *loc)
+{
+	mark_remove(&loc->mark);
+	free(loc->filename);
+	free(loc);
+}
+
 static bool move_to_file(const char *filename, int save_location)
 {
 	struct file_location *loc = NULL;
@@ -37,10 +48,8 @@ static bool move_to_file(const char *filename, int save_location)
 
 	v = open_buffer(filename, true, NULL);
 	if (!v) {
-		if (loc) {
-			free(loc->filename);
-			free(loc);
-		}
+		if (loc)
+			free_location(loc);
 		return false;
 	}
 	if (loc)
@@ -68,19 +77,23 @@ void pop_location(void)
 			v = open_buffer(loc->filename, true, NULL);
 		} else {
 			// Can't restore closed buffer which had no filename.
-			free(loc->filename);
-			free(loc);
+			free_location(loc);
 			pop_location();
 			return;
 		}
 	}
 	if (v) {
 		set_view(v);
-		move_to_line(loc->row);
-		move_to_column(loc->col);
+		if (loc->mark.buffer == buffer) {
+			block_iter_goto_offset(&view->cursor, mark_offset(&loc->mark));
+			view->center_on_scroll = true;
+		} else {
+			// buffer was closed and reopened
+			move_to_line(loc->row);
+			move_to_column(loc->col);
+		}
 	}
-	free(loc->filename);
-	free(loc);
+	free_location(loc);
 }
 
 static void free_message(struct message *m)
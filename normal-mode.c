@@ -5,19 +5,67 @@
 #include "bind.h"
 #include "input-special.h"
 #include "editor.h"
+#include "error.h"
 
+#define PASTE_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Pasted text is inserted while it is being read so that huge pastes
+ * don't need to be held in memory twice. Only command line is redrawn
+ * before the paste ends so lines are not highlighted until then.
+ */
 static void insert_paste(void)
 {
+	char *buf = xmalloc(PASTE_CHUNK_SIZE);
+	struct timeval start, now;
+	bool progress = false;
+	bool inserted;
+	long total = 0;
 	long size;
-	char *text = term_read_paste(&size);
+
+	gettimeofday(&start, NULL);
+	begin_change_chain();
 
 	// because this is not a command (see run_command()) you have to
 	// call begin_change() to avoid merging this change into previous
 	begin_change(CHANGE_MERGE_NONE);
-	insert_text(text, size);
+	if (selecting())
+		insert_text("", 0);
 	end_change();
 
-	free(text);
+	do {
+		// fill the chunk to avoid many small inserts
+		size = 0;
+		while (size < PASTE_CHUNK_SIZE) {
+			long rc = term_read_paste_chunk(buf + size, PASTE_CHUNK_SIZE - size);
+			if (!rc)
+				break;
+			size += rc;
+		}
+		if (size) {
+			// all chunks are merged into one insert change
+			begin_change(CHANGE_MERGE_INSERT);
+			inserted = buffer_insert_bytes(buf, size);
+			end_change();
+			if (inserted)
+				block_iter_skip_bytes(&view->cursor, size);
+			total += size;
+		}
+
+		gettimeofday(&now, NULL);
+		if (size == PASTE_CHUNK_SIZE && now.tv_sec - start.tv_sec >= 1) {
+			info_msg("Pasting... %ld KiB", total / 1024);
+			update_progress();
+			progress = true;
+		}
+	} while (size == PASTE_CHUNK_SIZE);
+	if (progress)
+		clear_error();
+
+	begin_change(CHANGE_MERGE_NONE);
+	end_change();
+	end_change_chain();
+	free(buf);
 }
 
 static void normal_mode_keypress(enum term_key_type type, unsigned int key)
@@ -28,9 +76,9 @@ static void normal_mode_keypress(enum term_key_type type, unsigned int key)
 	if (special_input_keypress(type, key, buf, &count)) {
 		if (count) {
 			begin_change(CHANGE_MERGE_NONE);
-			buffer_insert_bytes(buf, count);
+			if (buffer_insert_bytes(buf, count))
+				block_iter_skip_bytes(&view->cursor, count);
 			end_change();
-			block_iter_skip_bytes(&view->cursor, count);
 		}
 		return;
 	}
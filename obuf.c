@@ -2,20 +2,111 @@
 #include "term.h"
 #include "common.h"
 #include "uchar.h"
+#include "options.h"
 
 struct output_buffer obuf;
 int screen_w = 80;
 int screen_h = 24;
 
-static int obuf_avail(void)
+// cursor position and color of the terminal, -1 if not known
+static int term_x = -1;
+static int term_y = -1;
+static struct term_color term_color;
+static bool term_color_known;
+
+// DEC private mode 2026, used if the terminal reports support for it
+#define BEGIN_SYNC "\033[?2026h"
+#define END_SYNC "\033[?2026l"
+#define BEGIN_SYNC_LEN (sizeof(BEGIN_SYNC) - 1)
+
+static void obuf_need_space(long count)
+{
+	long min = obuf.count + count + BEGIN_SYNC_LEN + sizeof(END_SYNC);
+
+	// frame starts after room for BEGIN_SYNC
+	if (!obuf.count)
+		obuf.count = BEGIN_SYNC_LEN;
+
+	if (min > obuf.alloc) {
+		obuf.alloc = ROUND_UP(min, 8192);
+		xrenew(obuf.buf, obuf.alloc);
+	}
+}
+
+static void add_raw(const char *str, int count)
+{
+	obuf_need_space(count);
+	memcpy(obuf.buf + obuf.count, str, count);
+	obuf.count += count;
+}
+
+static struct cell *back_cell(int x, int y)
 {
-	return sizeof(obuf.buf) - obuf.count;
+	return obuf.back + y * obuf.grid_w + x;
 }
 
-static void obuf_need_space(int count)
+static void blank_cell(struct cell *c)
 {
-	if (obuf_avail() < count)
-		buf_flush();
+	clear(c);
+	c->u = ' ';
+	c->width = 1;
+	c->color = obuf.color;
+}
+
+static void put_cell(unsigned int u, unsigned int width)
+{
+	int x = obuf.cx;
+	int y = obuf.cy;
+	struct cell *c;
+
+	obuf.cx += width;
+	if (y < 0 || y >= obuf.grid_h || x < 0 || x + width > obuf.grid_w)
+		return;
+
+	c = back_cell(x, y);
+	if (!c->width && x > 0) {
+		// overwriting right half of double width character
+		blank_cell(c - 1);
+	}
+	if (c->width == 2 && width == 1 && x + 1 < obuf.grid_w) {
+		// overwriting left half of double width character
+		blank_cell(c + 1);
+	}
+	clear(c);
+	c->u = u;
+	c->width = width;
+	c->color = obuf.color;
+	if (width == 2) {
+		if (x + 2 < obuf.grid_w && c[2].width == 0)
+			blank_cell(c + 2);
+		clear(c + 1);
+		c[1].color = obuf.color;
+	}
+	obuf.dirty[y] = true;
+}
+
+static void put_cells(const char *str, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		put_cell((unsigned char)str[i], 1);
+}
+
+static void put_combining(unsigned int u)
+{
+	int x = obuf.cx - 1;
+	int y = obuf.cy;
+	struct cell *c;
+
+	if (y < 0 || y >= obuf.grid_h || x < 0 || x >= obuf.grid_w)
+		return;
+
+	c = back_cell(x, y);
+	if (!c->width && x > 0)
+		c--;
+	c->combining = u;
+	obuf.dirty[y] = true;
 }
 
 void buf_reset(unsigned int start_x, unsigned int width, unsigned int scroll_x)
@@ -25,21 +116,12 @@ void buf_reset(unsigned int start_x, unsigned int width, unsigned int scroll_x)
 	obuf.scroll_x = scroll_x;
 	obuf.tab_width = 8;
 	obuf.tab = TAB_CONTROL;
-	obuf.can_clear = start_x + width == screen_w;
 }
 
 // does not update obuf.x
 void buf_add_bytes(const char *str, int count)
 {
-	if (count > obuf_avail()) {
-		buf_flush();
-		if (count >= sizeof(obuf.buf)) {
-			xwrite(1, str, count);
-			return;
-		}
-	}
-	memcpy(obuf.buf + obuf.count, str, count);
-	obuf.count += count;
+	put_cells(str, count);
 }
 
 void buf_set_bytes(char ch, int count)
@@ -58,30 +140,19 @@ void buf_set_bytes(char ch, int count)
 	}
 
 	obuf.x += count;
-	while (count) {
-		int avail, n = count;
-
-		obuf_need_space(1);
-		avail = obuf_avail();
-		if (n > avail)
-			n = avail;
-
-		memset(obuf.buf + obuf.count, ch, n);
-		obuf.count += n;
-		count -= n;
-	}
+	while (count-- > 0)
+		put_cell((unsigned char)ch, 1);
 }
 
 // does not update obuf.x
 void buf_add_ch(char ch)
 {
-	obuf_need_space(1);
-	obuf.buf[obuf.count++] = ch;
+	put_cell((unsigned char)ch, 1);
 }
 
 void buf_escape(const char *str)
 {
-	buf_add_bytes(str, strlen(str));
+	add_raw(str, strlen(str));
 }
 
 void buf_add_str(const char *str)
@@ -107,61 +178,62 @@ void buf_show_cursor(void)
 
 void buf_move_cursor(int x, int y)
 {
-	buf_escape(term_move_cursor(x, y));
+	obuf.cx = x;
+	obuf.cy = y;
 }
 
 void buf_set_color(const struct term_color *color)
 {
-	if (!memcmp(color, &obuf.color, sizeof(*color)))
-		return;
-
-	buf_escape(term_set_color(color));
 	obuf.color = *color;
 }
 
 void buf_clear_eol(void)
 {
-	if (obuf.x < obuf.scroll_x + obuf.width) {
-		if (obuf.can_clear && term_cap.strings[STR_CAP_CMD_ce] && (obuf.color.bg < 0 || term_cap.ut)) {
-			buf_escape(term_cap.strings[STR_CAP_CMD_ce]);
-			obuf.x = obuf.scroll_x + obuf.width;
-		} else {
-			buf_set_bytes(' ', obuf.scroll_x + obuf.width - obuf.x);
-		}
-	}
+	if (obuf.x < obuf.scroll_x + obuf.width)
+		buf_set_bytes(' ', obuf.scroll_x + obuf.width - obuf.x);
 }
 
+// output everything at once so that terminal never shows half drawn frame
 void buf_flush(void)
 {
-	if (obuf.count) {
-		xwrite(1, obuf.buf, obuf.count);
+	long start = BEGIN_SYNC_LEN;
+
+	if (obuf.count <= start) {
 		obuf.count = 0;
+		return;
+	}
+	if (options.synchronized_output && term_sync_supported) {
+		// obuf_need_space() reserved room for these
+		memcpy(obuf.buf, BEGIN_SYNC, start);
+		memcpy(obuf.buf + obuf.count, END_SYNC, sizeof(END_SYNC) - 1);
+		obuf.count += sizeof(END_SYNC) - 1;
+		start = 0;
 	}
+	xwrite(1, obuf.buf + start, obuf.count - start);
+	obuf.count = 0;
 }
 
 static void skipped_too_much(unsigned int u)
 {
 	int n = obuf.x - obuf.scroll_x;
 
-	obuf_need_space(8);
 	if (u == '\t' && obuf.tab != TAB_CONTROL) {
 		char ch = ' ';
 		if (obuf.tab == TAB_SPECIAL)
 			ch = '-';
-		memset(obuf.buf + obuf.count, ch, n);
-		obuf.count += n;
+		while (n--)
+			put_cell(ch, 1);
 	} else if (u < 0x20) {
-		obuf.buf[obuf.count++] = u | 0x40;
+		put_cell(u | 0x40, 1);
 	} else if (u == 0x7f) {
-		obuf.buf[obuf.count++] = '?';
+		put_cell('?', 1);
 	} else if (u_is_unprintable(u)) {
 		char tmp[4];
 		long idx = 0;
 		u_set_hex(tmp, &idx, u);
-		memcpy(obuf.buf + obuf.count, tmp + 4 - n, n);
-		obuf.count += n;
+		put_cells(tmp + 4 - n, n);
 	} else {
-		obuf.buf[obuf.count++] = '>';
+		put_cell('>', 1);
 	}
 }
 
@@ -190,22 +262,22 @@ static void print_tab(unsigned int width)
 	char ch = ' ';
 
 	if (obuf.tab == TAB_SPECIAL) {
-		obuf.buf[obuf.count++] = '>';
+		put_cell('>', 1);
 		obuf.x++;
 		width--;
 		ch = '-';
 	}
-	if (width > 0) {
-		memset(obuf.buf + obuf.count, ch, width);
-		obuf.count += width;
-		obuf.x += width;
-	}
+	obuf.x += width;
+	while (width--)
+		put_cell(ch, 1);
 }
 
 bool buf_put_char(unsigned int u)
 {
 	unsigned int space = obuf.scroll_x + obuf.width - obuf.x;
 	unsigned int width;
+	char tmp[8];
+	long idx = 0;
 
 	if (obuf.x < obuf.scroll_x) {
 		// scrolled, char (at least partially) invisible
@@ -216,10 +288,9 @@ bool buf_put_char(unsigned int u)
 	if (!space)
 		return false;
 
-	obuf_need_space(8);
 	if (likely(u < 0x80)) {
 		if (likely(!u_is_ctrl(u))) {
-			obuf.buf[obuf.count++] = u;
+			put_cell(u, 1);
 			obuf.x++;
 		} else if (u == '\t' && obuf.tab != TAB_CONTROL) {
 			width = (obuf.x + obuf.tab_width) / obuf.tab_width * obuf.tab_width - obuf.x;
@@ -227,46 +298,286 @@ bool buf_put_char(unsigned int u)
 				width = space;
 			print_tab(width);
 		} else {
-			u_set_ctrl(obuf.buf, &obuf.count, u);
-			obuf.x += 2;
+			u_set_ctrl(tmp, &idx, u);
 			if (unlikely(space == 1)) {
-				// wrote too much
-				obuf.count--;
-				obuf.x--;
+				// only "^" fits
+				idx--;
 			}
+			put_cells(tmp, idx);
+			obuf.x += idx;
 		}
 	} else {
 		width = u_char_width(u);
 		if (width <= space) {
 			obuf.x += width;
-			if (term_utf8) {
-				u_set_char(obuf.buf, &obuf.count, u);
-			} else {
+			if (u_is_unprintable(u)) {
+				u_set_hex(tmp, &idx, u);
+				put_cells(tmp, idx);
+			} else if (term_utf8) {
+				if (width)
+					put_cell(u, width);
+				else
+					put_combining(u);
+			} else if (u <= 0xff) {
 				// terminal character set is assumed to be latin1
-				if (u_is_unprintable(u)) {
-					u_set_hex(obuf.buf, &obuf.count, u);
-				} else if (u <= 0xff) {
-					obuf.buf[obuf.count++] = u;
-				} else {
-					// character can't be displayed
-					while (width--) {
-						// inverted question mark
-						obuf.buf[obuf.count++] = 0xbf;
-					}
+				put_cell(u, 1);
+			} else {
+				// character can't be displayed
+				while (width--) {
+					// inverted question mark
+					put_cell(0xbf, 1);
 				}
 			}
 		} else if (u_is_unprintable(u)) {
 			// <xx> would not fit
-			// there's enough space in the buffer so render all 4 characters
-			// but increment position less
-			long idx = obuf.count;
-			u_set_hex(obuf.buf, &idx, u);
-			obuf.count += space;
+			u_set_hex(tmp, &idx, u);
+			put_cells(tmp, space);
 			obuf.x += space;
 		} else {
-			obuf.buf[obuf.count++] = '>';
+			put_cell('>', 1);
 			obuf.x++;
 		}
 	}
 	return true;
 }
+
+// forget what the terminal displays, resize grid if screen size changed
+void buf_invalidate(void)
+{
+	int i, count = screen_w * screen_h;
+
+	if (screen_w != obuf.grid_w || screen_h != obuf.grid_h) {
+		obuf.grid_w = screen_w;
+		obuf.grid_h = screen_h;
+		xrenew(obuf.back, count);
+		xrenew(obuf.front, count);
+		xrenew(obuf.dirty, screen_h);
+		for (i = 0; i < count; i++)
+			blank_cell(&obuf.back[i]);
+	}
+	for (i = 0; i < count; i++) {
+		clear(&obuf.front[i]);
+		obuf.front[i].u = -1;
+	}
+	for (i = 0; i < screen_h; i++)
+		obuf.dirty[i] = true;
+	term_x = -1;
+	term_y = -1;
+	term_color_known = false;
+}
+
+void buf_move_term_cursor(int x, int y)
+{
+	const char *forward = NULL;
+
+	if (x == term_x && y == term_y)
+		return;
+
+	if (y == term_y && x > term_x && term_x >= 0)
+		forward = term_cursor_forward(x - term_x);
+	if (forward) {
+		buf_escape(forward);
+	} else if (y == term_y && x == 0) {
+		add_raw("\r", 1);
+	} else {
+		buf_escape(term_move_cursor(x, y));
+	}
+	term_x = x;
+	term_y = y;
+}
+
+void buf_set_term_color(const struct term_color *color)
+{
+	if (term_color_known && !memcmp(color, &term_color, sizeof(*color)))
+		return;
+
+	// send only what differs from the current color if it is known
+	buf_escape(term_set_color(color, term_color_known ? &term_color : NULL));
+	term_color = *color;
+	term_color_known = true;
+}
+
+static void repeat_cap(int cap, int count)
+{
+	while (count--)
+		buf_escape(term_cap.strings[cap]);
+}
+
+static bool scroll_terminal(int top, int bottom, int count)
+{
+	const char *region = term_scroll_region(top, bottom);
+	int n = count > 0 ? count : -count;
+
+	if (region && term_cap.strings[count > 0 ? STR_CAP_CMD_sf : STR_CAP_CMD_sr]) {
+		buf_escape(region);
+		if (count > 0) {
+			buf_escape(term_move_cursor(0, bottom));
+			repeat_cap(STR_CAP_CMD_sf, n);
+		} else {
+			buf_escape(term_move_cursor(0, top));
+			repeat_cap(STR_CAP_CMD_sr, n);
+		}
+		buf_escape(term_scroll_region(0, obuf.grid_h - 1));
+		return true;
+	}
+	if (term_cap.strings[STR_CAP_CMD_al] && term_cap.strings[STR_CAP_CMD_dl]) {
+		// lines below the region move temporarily
+		if (count > 0) {
+			buf_escape(term_move_cursor(0, top));
+			repeat_cap(STR_CAP_CMD_dl, n);
+			buf_escape(term_move_cursor(0, bottom - n + 1));
+			repeat_cap(STR_CAP_CMD_al, n);
+		} else {
+			buf_escape(term_move_cursor(0, bottom - n + 1));
+			repeat_cap(STR_CAP_CMD_dl, n);
+			buf_escape(term_move_cursor(0, top));
+			repeat_cap(STR_CAP_CMD_al, n);
+		}
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Move rows top..bottom up (count > 0) or down (count < 0) on the
+ * terminal so that only the exposed rows need to be drawn. Rows are
+ * moved across the whole width of the screen.
+ */
+bool buf_scroll(int top, int bottom, int count)
+{
+	struct term_color color = { -1, -1, 0 };
+	int y, n = count > 0 ? count : -count;
+	int w = obuf.grid_w;
+
+	if (!count || n > bottom - top || bottom >= obuf.grid_h)
+		return false;
+
+	// inserted lines are cleared using current background color
+	buf_set_term_color(&color);
+	if (!scroll_terminal(top, bottom, count))
+		return false;
+	term_x = -1;
+	term_y = -1;
+
+	if (count > 0) {
+		memmove(obuf.front + top * w, obuf.front + (top + n) * w, (bottom - top + 1 - n) * w * sizeof(struct cell));
+		y = bottom - n + 1;
+	} else {
+		memmove(obuf.front + (top + n) * w, obuf.front + top * w, (bottom - top + 1 - n) * w * sizeof(struct cell));
+		y = top;
+	}
+	for (n += y; y < n; y++) {
+		int x;
+
+		for (x = 0; x < w; x++) {
+			struct cell *c = obuf.front + y * w + x;
+			clear(c);
+			c->u = ' ';
+			c->width = 1;
+			c->color = color;
+		}
+	}
+	for (y = top; y <= bottom; y++)
+		obuf.dirty[y] = true;
+	return true;
+}
+
+static bool cells_equal(const struct cell *a, const struct cell *b)
+{
+	return a->u == b->u && a->combining == b->combining && a->width == b->width &&
+		!memcmp(&a->color, &b->color, sizeof(a->color));
+}
+
+// rest of the row can be cleared with "ce"
+static bool can_clear_rest(const struct cell *row, int x)
+{
+	const struct cell *c = &row[x];
+	int i;
+
+	if (obuf.grid_w - x < 4 || !term_cap.strings[STR_CAP_CMD_ce])
+		return false;
+	if (c->color.bg >= 0 && !term_cap.ut)
+		return false;
+	for (i = x; i < obuf.grid_w; i++) {
+		if (row[i].u != ' ' || row[i].combining ||
+		    memcmp(&row[i].color, &c->color, sizeof(c->color)))
+			return false;
+	}
+	return true;
+}
+
+static void emit_cell(const struct cell *c)
+{
+	buf_set_term_color(&c->color);
+	obuf_need_space(16);
+	if (c->u < 0x80 || !term_utf8) {
+		obuf.buf[obuf.count++] = c->u;
+	} else {
+		u_set_char(obuf.buf, &obuf.count, c->u);
+	}
+	if (c->combining)
+		u_set_char(obuf.buf, &obuf.count, c->combining);
+	term_x += c->width;
+	if (term_x >= obuf.grid_w) {
+		// auto-margin may or may not have wrapped
+		term_x = -1;
+		term_y = -1;
+	}
+}
+
+static void flush_row(int y)
+{
+	struct cell *back = obuf.back + y * obuf.grid_w;
+	struct cell *front = obuf.front + y * obuf.grid_w;
+	int x = 0;
+
+	while (x < obuf.grid_w) {
+		if (cells_equal(&back[x], &front[x])) {
+			x++;
+			continue;
+		}
+		if (!back[x].width && x > 0) {
+			// start from the double width character
+			x--;
+		}
+		if (can_clear_rest(back, x)) {
+			buf_move_term_cursor(x, y);
+			buf_set_term_color(&back[x].color);
+			buf_escape(term_cap.strings[STR_CAP_CMD_ce]);
+			memcpy(front + x, back + x, (obuf.grid_w - x) * sizeof(*back));
+			return;
+		}
+		buf_move_term_cursor(x, y);
+		while (x < obuf.grid_w) {
+			int same = 0;
+
+			// rewriting few unchanged cells is cheaper than moving cursor
+			while (x + same < obuf.grid_w && same < 4 && cells_equal(&back[x + same], &front[x + same]))
+				same++;
+			if (same == 4 || x + same == obuf.grid_w)
+				break;
+
+			emit_cell(&back[x]);
+			if (back[x].width == 2) {
+				front[x + 1] = back[x + 1];
+				front[x] = back[x];
+				x += 2;
+			} else {
+				front[x] = back[x];
+				x++;
+			}
+		}
+	}
+}
+
+void buf_flush_cells(void)
+{
+	int y;
+
+	for (y = 0; y < obuf.grid_h; y++) {
+		if (obuf.dirty[y]) {
+			flush_row(y);
+			obuf.dirty[y] = false;
+		}
+	}
+}
@@ -4,9 +4,24 @@
 #include "term.h"
 #include "libc.h"
 
+/*
+ * Screen is drawn to a grid of cells. buf_flush_cells() compares it to
+ * what the terminal is known to display and outputs only changed cells.
+ */
+struct cell {
+	unsigned int u;
+	// combining character drawn over u or 0
+	unsigned int combining;
+	// 2 for double width character, 0 for the cell it covers
+	unsigned char width;
+	struct term_color color;
+};
+
 struct output_buffer {
-	char buf[8192];
+	// grows to hold a whole frame, written once by buf_flush()
+	char *buf;
 	long count;
+	long alloc;
 
 	// number of characters scrolled (x direction)
 	unsigned int scroll_x;
@@ -23,9 +38,17 @@ struct output_buffer {
 		TAB_SPECIAL,
 		TAB_CONTROL,
 	} tab;
-	bool can_clear;
 
 	struct term_color color;
+
+	// cell where next character is drawn
+	int cx, cy;
+
+	// wanted and displayed contents of the screen
+	struct cell *back;
+	struct cell *front;
+	bool *dirty;
+	int grid_w, grid_h;
 };
 
 extern struct output_buffer obuf;
@@ -45,5 +68,10 @@ void buf_set_color(const struct term_color *color);
 void buf_clear_eol(void);
 void buf_flush(void);
 bool buf_put_char(unsigned int u);
+void buf_invalidate(void);
+void buf_flush_cells(void);
+void buf_move_term_cursor(int x, int y);
+void buf_set_term_color(const struct term_color *color);
+bool buf_scroll(int top, int bottom, int count);
 
 #endif
@@ -2,6 +2,7 @@
 #include "buffer.h"
 #include "completion.h"
 #include "filetype.h"
+#include "follow.h"
 #include "common.h"
 #include "regexp.h"
 #include "error.h"
@@ -13,6 +14,7 @@ struct global_options options = {
 	.expand_tab = 0,
 	.file_history = 1,
 	.indent_width = 8,
+	.journal = 0,
 	.syntax = 1,
 	.tab_width = 8,
 	.text_width = 72,
@@ -28,8 +30,11 @@ struct global_options options = {
 	.show_tab_bar = 1,
 	.statusline_left = NULL,
 	.statusline_right = NULL,
+	.synchronized_output = 1,
 	.tab_bar_max_components = 0,
 	.tab_bar_width = 25,
+	.tag_files = NULL,
+	.undo_limit = 64,
 	.vertical_tab_bar = 0,
 };
 
@@ -381,8 +386,10 @@ static const struct option_desc option_desc[] = {
 	BOOL_OPT("expand-tab", C(expand_tab), NULL),
 	BOOL_OPT("file-history", C(file_history), NULL),
 	STR_OPT("filetype", L(filetype), validate_filetype, filetype_changed),
+	BOOL_OPT("follow", L(follow), follow_changed),
 	INT_OPT("indent-width", C(indent_width), 1, 8, NULL),
 	STR_OPT("indent-regex", L(indent_regex), validate_regex, NULL),
+	BOOL_OPT("journal", C(journal), NULL),
 	BOOL_OPT("lock-files", G(lock_files), NULL),
 	ENUM_OPT("newline", G(newline), newline_enum, NULL),
 	INT_OPT("scroll-margin", G(scroll_margin), 0, 100, NULL),
@@ -390,11 +397,14 @@ static const struct option_desc option_desc[] = {
 	BOOL_OPT("show-tab-bar", G(show_tab_bar), NULL),
 	STR_OPT("statusline-left", G(statusline_left), validate_statusline_format, NULL),
 	STR_OPT("statusline-right", G(statusline_right), validate_statusline_format, NULL),
+	BOOL_OPT("synchronized-output", G(synchronized_output), NULL),
 	BOOL_OPT("syntax", C(syntax), syntax_changed),
 	INT_OPT("tab-bar-max-components", G(tab_bar_max_components), 0, 10, NULL),
 	INT_OPT("tab-bar-width", G(tab_bar_width), TAB_BAR_MIN_WIDTH, 100, NULL),
 	INT_OPT("tab-width", C(tab_width), 1, 8, NULL),
+	STR_OPT("tag-files", G(tag_files), NULL, NULL),
 	INT_OPT("text-width", C(text_width), 1, 1000, NULL),
+	INT_OPT("undo-limit", G(undo_limit), 1, 65536, NULL),
 	BOOL_OPT("vertical-tab-bar", G(vertical_tab_bar), NULL),
 	FLAG_OPT("ws-error", C(ws_error), ws_error_values, NULL),
 };
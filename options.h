@@ -46,6 +46,7 @@ struct common_options {
 	int expand_tab;
 	int file_history;
 	int indent_width;
+	int journal;
 	int syntax;
 	int tab_width;
 	int text_width;
@@ -60,6 +61,7 @@ struct local_options {
 	int expand_tab;
 	int file_history;
 	int indent_width;
+	int journal;
 	int syntax;
 	int tab_width;
 	int text_width;
@@ -68,6 +70,7 @@ struct local_options {
 	/* only local */
 	int brace_indent;
 	char *filetype;
+	int follow;
 	char *indent_regex;
 };
 
@@ -79,6 +82,7 @@ struct global_options {
 	int expand_tab;
 	int file_history;
 	int indent_width;
+	int journal;
 	int syntax;
 	int tab_width;
 	int text_width;
@@ -95,8 +99,11 @@ struct global_options {
 	int show_tab_bar;
 	char *statusline_left;
 	char *statusline_right;
+	int synchronized_output;
 	int tab_bar_max_components;
 	int tab_bar_width;
+	char *tag_files;
+	int undo_limit;
 	int vertical_tab_bar;
 };
 
@@ -3,6 +3,8 @@
 #include "obuf.h"
 #include "selection.h"
 #include "hl.h"
+#include "col-index.h"
+#include "gbuf.h"
 
 struct line_info {
 	long line_nr;
@@ -16,6 +18,10 @@ struct line_info {
 	long indent_size;
 	long trailing_ws_offset;
 	struct hl_color **colors;
+
+	int ws_error_flags;
+	// index of first whitespace error span not before pos
+	long ws_span;
 };
 
 static bool is_default_bg_color(int color)
@@ -66,55 +72,108 @@ static int get_ws_error_option(void)
 	return flags;
 }
 
-static bool whitespace_error(struct line_info *info, unsigned int u, long i)
+// whitespace errors of current line, sorted
+static struct ws_span {
+	long start;
+	long end;
+} *ws_spans;
+static long nr_ws_spans;
+static long ws_spans_alloc;
+
+static void add_ws_error(long start, long end)
 {
-	int flags = get_ws_error_option();
+	if (nr_ws_spans && ws_spans[nr_ws_spans - 1].end == start) {
+		ws_spans[nr_ws_spans - 1].end = end;
+		return;
+	}
+	if (nr_ws_spans == ws_spans_alloc) {
+		ws_spans_alloc = ws_spans_alloc ? ws_spans_alloc * 2 : 16;
+		xrenew(ws_spans, ws_spans_alloc);
+	}
+	ws_spans[nr_ws_spans].start = start;
+	ws_spans[nr_ws_spans].end = end;
+	nr_ws_spans++;
+}
 
-	if (i >= info->trailing_ws_offset && flags & WSE_TRAILING) {
-		// Trailing whitespace.
-		if (info->line_nr != view->cy || view->cx < info->trailing_ws_offset)
-			return true;
-		// Cursor is on this line and on the whitespace or at eol. It would
-		// be annoying if the line you are editing displays trailing
-		// whitespace as an error.
+static void add_trailing_ws_error(long start, long end)
+{
+	// may overlap errors in indentation if line contains only whitespace
+	while (nr_ws_spans && ws_spans[nr_ws_spans - 1].start >= start)
+		nr_ws_spans--;
+	if (nr_ws_spans && ws_spans[nr_ws_spans - 1].end >= start) {
+		ws_spans[nr_ws_spans - 1].end = end;
+		return;
 	}
+	add_ws_error(start, end);
+}
+
+static void find_indent_ws_errors(struct line_info *info)
+{
+	int flags = info->ws_error_flags;
+	const unsigned char *line = info->line;
+	long i = 0;
 
-	if (u == '\t') {
-		if (i < info->indent_size) {
-			// in indentation
+	while (i < info->indent_size) {
+		long start = i;
+		bool error;
+
+		if (line[i] == '\t') {
 			if (flags & WSE_TAB_INDENT)
-				return true;
-		} else {
-			if (flags & WSE_TAB_AFTER_INDENT)
-				return true;
-		}
-	} else if (i < info->indent_size) {
-		// space in indentation
-		const char *line = info->line;
-		int count = 0, pos = i;
-
-		while (pos > 0 && line[pos - 1] == ' ')
-			pos--;
-		while (pos < info->size && line[pos] == ' ') {
-			pos++;
-			count++;
+				add_ws_error(i, i + 1);
+			i++;
+			continue;
 		}
 
-		if (count >= buffer->options.tab_width) {
+		while (i < info->size && line[i] == ' ')
+			i++;
+		if (i - start >= buffer->options.tab_width) {
 			// spaces used instead of tab
-			if (flags & WSE_SPACE_INDENT)
-				return true;
-		} else if (pos < info->size && line[pos] == '\t') {
+			error = flags & WSE_SPACE_INDENT;
+		} else if (i < info->size && line[i] == '\t') {
 			// space before tab
-			if (flags & WSE_SPACE_INDENT)
-				return true;
+			error = flags & WSE_SPACE_INDENT;
 		} else {
 			// less than tab width spaces at end of indentation
-			if (flags & WSE_SPACE_ALIGN)
-				return true;
+			error = flags & WSE_SPACE_ALIGN;
 		}
+		if (error)
+			add_ws_error(start, i);
+	}
+}
+
+static void find_ws_errors(struct line_info *info)
+{
+	int flags = info->ws_error_flags;
+	long i;
+
+	nr_ws_spans = 0;
+	info->ws_span = 0;
+
+	if (flags & (WSE_TAB_INDENT | WSE_SPACE_INDENT | WSE_SPACE_ALIGN))
+		find_indent_ws_errors(info);
+
+	if (flags & WSE_TAB_AFTER_INDENT) {
+		for (i = info->indent_size; i < info->size; i++) {
+			if (info->line[i] == '\t')
+				add_ws_error(i, i + 1);
+		}
+	}
+
+	if (info->trailing_ws_offset < info->size && flags & WSE_TRAILING) {
+		// It would be annoying if the line you are editing displayed
+		// trailing whitespace as an error when the cursor is on the
+		// whitespace or at eol.
+		if (info->line_nr != view->cy || view->cx < info->trailing_ws_offset)
+			add_trailing_ws_error(info->trailing_ws_offset, info->size);
 	}
-	return false;
+}
+
+static bool whitespace_error(struct line_info *info, long i)
+{
+	// characters are visited in order
+	while (info->ws_span < nr_ws_spans && ws_spans[info->ws_span].end <= i)
+		info->ws_span++;
+	return info->ws_span < nr_ws_spans && ws_spans[info->ws_span].start <= i;
 }
 
 static unsigned int screen_next_char(struct line_info *info)
@@ -128,13 +187,13 @@ static unsigned int screen_next_char(struct line_info *info)
 		info->pos++;
 		count = 1;
 		if (u == '\t' || u == ' ')
-			ws_error = whitespace_error(info, u, pos);
+			ws_error = whitespace_error(info, pos);
 	} else {
 		u = u_get_nonascii(info->line, info->size, &info->pos);
 		count = info->pos - pos;
 
 		// highly annoying no-break space etc.?
-		if (u_is_special_whitespace(u) && (buffer->options.ws_error & WSE_SPECIAL))
+		if (u_is_special_whitespace(u) && (info->ws_error_flags & WSE_SPECIAL))
 			ws_error = true;
 	}
 
@@ -236,14 +295,15 @@ static void line_info_init(struct line_info *info, struct block_iter *bi, long l
 	memset(info, 0, sizeof(*info));
 	info->line_nr = line_nr;
 	info->offset = block_iter_get_offset(bi);
+	info->ws_error_flags = get_ws_error_option();
 
 	if (!selecting()) {
 		info->sel_so = -1;
 		info->sel_eo = -1;
-	} else if (view->sel_eo != UINT_MAX) {
+	} else if (view->sel_eo.buffer) {
 		/* already calculated */
-		info->sel_so = view->sel_so;
-		info->sel_eo = view->sel_eo;
+		info->sel_so = mark_offset(&view->sel_so);
+		info->sel_eo = mark_offset(&view->sel_eo);
 		BUG_ON(info->sel_so > info->sel_eo);
 	} else {
 		struct selection_info sel;
@@ -280,6 +340,8 @@ static void line_info_set_line(struct line_info *info, struct lineref *lr, struc
 			break;
 		info->trailing_ws_offset = i;
 	}
+
+	find_ws_errors(info);
 }
 
 static void print_line(struct line_info *info)
@@ -287,6 +349,18 @@ static void print_line(struct line_info *info)
 	struct term_color color;
 	unsigned int u;
 
+	if (obuf.scroll_x > 8) {
+		// jump close to the first visible character in long lines
+		struct col_pos pos;
+
+		col_index_seek_col(&pos, info->line, info->size, obuf.tab == TAB_CONTROL, obuf.scroll_x - 8);
+		if (pos.offset > info->pos) {
+			info->offset += pos.offset - info->pos;
+			info->pos = pos.offset;
+			obuf.x = pos.col;
+		}
+	}
+
 	// Screen might be scrolled horizontally. Skip most invisible
 	// characters using screen_skip_char() which is much faster than
 	// buf_skip(screen_next_char(info)).
@@ -324,10 +398,169 @@ static void print_line(struct line_info *info)
 	buf_clear_eol();
 }
 
+/*
+ * Drawing a line is much slower than hashing everything that affects how
+ * it looks. Cells of recently drawn lines are remembered per window so
+ * that lines which are redrawn unchanged (other line changed, view
+ * scrolled, another window shows the same buffer) can be copied to the
+ * screen grid. Rows which already contain the right cells aren't even
+ * marked dirty.
+ *
+ * Key of a line contains the line, its colors and everything else
+ * print_line() looks at except color definitions. forget_rendered_lines()
+ * must be called when they change. Hash of the key selects the slot and
+ * the whole key is compared before the cells are reused.
+ */
+
+// hashing longer lines costs more than drawing the visible part
+#define MAX_RENDERED_LINE_SIZE 4096
+
+static GBUF(line_key);
+
+static unsigned long long hash_add(unsigned long long hash, unsigned long long val)
+{
+	// FNV-1a, one word at a time
+	return (hash ^ val) * 0x100000001b3ULL;
+}
+
+// fills line_key, returns 0 if the line is not cached
+static unsigned long long line_hash(const struct line_info *info)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	long start = info->offset;
+	long so = info->sel_so - start;
+	long eo = info->sel_eo - start;
+	bool current = info->line_nr == view->cy;
+	long params[10];
+	size_t i;
+
+	gbuf_clear(&line_key);
+	if (info->size > MAX_RENDERED_LINE_SIZE)
+		return 0;
+
+	// only the part of selection which is on this line matters
+	if (so < 0)
+		so = 0;
+	if (eo > info->size + 1)
+		eo = info->size + 1;
+	if (so >= eo)
+		so = eo = 0;
+
+	params[0] = info->size;
+	params[1] = obuf.scroll_x;
+	params[2] = obuf.width;
+	params[3] = obuf.tab_width;
+	params[4] = obuf.tab;
+	params[5] = info->ws_error_flags;
+	params[6] = so;
+	params[7] = eo;
+	params[8] = current;
+	params[9] = current && view->cx < info->trailing_ws_offset;
+	gbuf_add_buf(&line_key, (const char *)params, sizeof(params));
+	gbuf_add_buf(&line_key, (const char *)info->line, info->size);
+	if (info->colors)
+		gbuf_add_buf(&line_key, (const char *)info->colors, info->size * sizeof(info->colors[0]));
+
+	for (i = 0; i < line_key.len; i += sizeof(unsigned long long)) {
+		unsigned long long val = 0;
+		size_t n = line_key.len - i;
+
+		if (n > sizeof(val))
+			n = sizeof(val);
+		memcpy(&val, line_key.buffer + i, n);
+		hash = hash_add(hash, val);
+	}
+	// 0 means not cached
+	return hash ? hash : 1;
+}
+
+void free_rendered_lines(struct window *w)
+{
+	int i;
+
+	for (i = 0; i < w->nr_rendered; i++)
+		gbuf_free(&w->rendered_keys[i]);
+	free(w->rendered_keys);
+	free(w->rendered_hash);
+	free(w->rendered_cells);
+}
+
+static void init_rendered_lines(void)
+{
+	int nr = window->edit_h * 2 + 1;
+	int i;
+
+	if (window->nr_rendered == nr && window->rendered_w == window->edit_w)
+		return;
+
+	free_rendered_lines(window);
+	window->nr_rendered = nr;
+	window->rendered_w = window->edit_w;
+	window->rendered_hash = xnew0(unsigned long long, nr);
+	window->rendered_keys = xnew(struct gbuf, nr);
+	for (i = 0; i < nr; i++)
+		gbuf_init(&window->rendered_keys[i]);
+	window->rendered_cells = xnew(struct cell, nr * window->edit_w);
+}
+
+static struct cell *screen_row(int y)
+{
+	return obuf.back + (window->edit_y + y) * obuf.grid_w + window->edit_x;
+}
+
+static bool copy_rendered_line(int y, unsigned long long hash)
+{
+	long size = window->rendered_w * sizeof(struct cell);
+	struct cell *cells, *row;
+	struct gbuf *key;
+	int idx;
+
+	if (!hash)
+		return false;
+	idx = hash % window->nr_rendered;
+	key = &window->rendered_keys[idx];
+	if (window->rendered_hash[idx] != hash || key->len != line_key.len ||
+	    memcmp(key->buffer, line_key.buffer, key->len))
+		return false;
+	cells = window->rendered_cells + idx * window->rendered_w;
+	row = screen_row(y);
+	if (memcmp(row, cells, size)) {
+		memcpy(row, cells, size);
+		obuf.dirty[window->edit_y + y] = true;
+	}
+	return true;
+}
+
+static void save_rendered_line(int y, unsigned long long hash)
+{
+	int idx = hash % window->nr_rendered;
+	struct gbuf *key = &window->rendered_keys[idx];
+
+	if (!hash)
+		return;
+	window->rendered_hash[idx] = hash;
+	gbuf_clear(key);
+	gbuf_add_buf(key, (const char *)line_key.buffer, line_key.len);
+	memcpy(window->rendered_cells + idx * window->rendered_w, screen_row(y),
+		window->rendered_w * sizeof(struct cell));
+}
+
+void forget_rendered_lines(void)
+{
+	int i;
+
+	for (i = 0; i < windows.count; i++) {
+		struct window *w = WINDOW(i);
+		if (w->nr_rendered)
+			memset(w->rendered_hash, 0, w->nr_rendered * sizeof(w->rendered_hash[0]));
+	}
+}
+
 void update_range(int y1, int y2)
 {
 	struct line_info info;
 	struct block_iter bi = view->cursor;
+	bool cache;
 	int i, got_line;
 
 	buf_reset(window->edit_x, window->edit_w, view->vx);
@@ -345,11 +578,18 @@ void update_range(int y1, int y2)
 	y1 -= view->vy;
 	y2 -= view->vy;
 
+	// edit area must be inside the screen grid
+	cache = window->edit_y + window->edit_h <= obuf.grid_h &&
+		window->edit_x + window->edit_w <= obuf.grid_w;
+	if (cache)
+		init_rendered_lines();
+
 	got_line = !block_iter_is_eof(&bi);
 	hl_fill_start_states(info.line_nr);
 	for (i = y1; got_line && i < y2; i++) {
 		struct lineref lr;
 		struct hl_color **colors;
+		unsigned long long hash;
 		int next_changed;
 
 		obuf.x = 0;
@@ -358,7 +598,14 @@ void update_range(int y1, int y2)
 		fill_line_nl_ref(&bi, &lr);
 		colors = hl_line(lr.line, lr.size, info.line_nr, &next_changed);
 		line_info_set_line(&info, &lr, colors);
-		print_line(&info);
+		hash = cache ? line_hash(&info) : 0;
+		if (copy_rendered_line(i, hash)) {
+			// +1 for newline
+			info.offset += info.size + 1;
+		} else {
+			print_line(&info);
+			save_rendered_line(i, hash);
+		}
 
 		got_line = block_iter_next_line(&bi);
 		info.line_nr++;
@@ -13,6 +13,8 @@ int print_command(char prefix);
 void print_message(const char *msg, bool is_error);
 void update_term_title(void);
 void update_range(int y1, int y2);
+void forget_rendered_lines(void);
+void free_rendered_lines(struct window *w);
 void update_separators(void);
 void update_status_line(void);
 void update_window_sizes(void);
@@ -336,12 +336,6 @@ static int replace_on_line(struct lineref *lr, regex_t *re, const char *format,
 			free(str);
 			nr++;
 
-			/* update selection length */
-			if (selecting()) {
-				view->sel_eo += nr_insert;
-				view->sel_eo -= match_len;
-			}
-
 			/* move cursor after the replaced text */
 			block_iter_skip_bytes(&view->cursor, nr_insert);
 		}
@@ -388,8 +382,8 @@ void reg_replace(const char *pattern, const char *format, unsigned int flags)
 		struct selection_info info;
 		init_selection(&info);
 		view->cursor = info.si;
-		view->sel_so = info.so;
-		view->sel_eo = info.eo;
+		mark_move(&view->sel_so, info.so);
+		mark_add(buffer, &view->sel_eo, info.eo);
 		swapped = info.swapped;
 		bi = view->cursor;
 		nr_bytes = info.eo - info.so;
@@ -443,14 +437,16 @@ void reg_replace(const char *pattern, const char *format, unsigned int flags)
 
 	if (selecting()) {
 		// undo what init_selection() did
-		if (view->sel_eo)
-			view->sel_eo--;
+		long eo = mark_offset(&view->sel_eo);
+
+		if (eo)
+			eo--;
 		if (swapped) {
-			long tmp = view->sel_so;
-			view->sel_so = view->sel_eo;
-			view->sel_eo = tmp;
+			long tmp = mark_offset(&view->sel_so);
+			mark_move(&view->sel_so, eo);
+			eo = tmp;
 		}
-		block_iter_goto_offset(&view->cursor, view->sel_eo);
-		view->sel_eo = UINT_MAX;
+		block_iter_goto_offset(&view->cursor, eo);
+		mark_remove(&view->sel_eo);
 	}
 }
@@ -6,7 +6,7 @@ void init_selection(struct selection_info *info)
 	struct block_iter ei;
 	unsigned int u;
 
-	info->so = view->sel_so;
+	info->so = mark_offset(&view->sel_so);
 	info->eo = block_iter_get_offset(&view->cursor);
 	info->si = view->cursor;
 	block_iter_goto_offset(&info->si, info->so);
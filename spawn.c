@@ -61,6 +61,81 @@ static void read_errors(struct compiler *c, int fd, int quiet)
 	fclose(f);
 }
 
+static int handle_child_error(int pid)
+{
+	int ret = wait_child(pid);
+
+	if (ret < 0) {
+		error_msg("waitpid: %s", strerror(errno));
+	} else if (ret >= 256) {
+		error_msg("Child received signal %d", ret >> 8);
+	} else if (ret) {
+		error_msg("Child returned %d", ret);
+	}
+	return ret;
+}
+
+/*
+ * Quiet compiler runs in the background and its output is parsed line by
+ * line as it arrives so that the editor can be used during a build.
+ */
+static struct compiler *build_compiler;
+static int build_pid;
+static struct gbuf build_output = GBUF_INIT;
+
+// parse complete lines, or everything at EOF
+static void parse_build_output(bool eof)
+{
+	char *buf = (char *)build_output.buffer;
+	size_t pos = 0;
+
+	if (eof && build_output.len && buf[build_output.len - 1] != '\n')
+		gbuf_add_ch(&build_output, '\n');
+	buf = (char *)build_output.buffer;
+	while (pos < build_output.len) {
+		char *nl = memchr(buf + pos, '\n', build_output.len - pos);
+
+		if (!nl)
+			break;
+		handle_error_msg(build_compiler, buf + pos);
+		pos = nl - buf + 1;
+	}
+	gbuf_remove(&build_output, 0, pos);
+}
+
+static void build_output_ready(int fd)
+{
+	ssize_t rc;
+	int ret;
+
+	gbuf_grow(&build_output, 8192);
+	rc = read(fd, build_output.buffer + build_output.len, 8192);
+	if (rc < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (rc > 0) {
+		build_output.len += rc;
+		parse_build_output(false);
+		return;
+	}
+
+	parse_build_output(true);
+	gbuf_free(&build_output);
+	unwatch_fd(fd);
+	close(fd);
+	ret = handle_child_error(build_pid);
+	build_pid = 0;
+	build_compiler = NULL;
+	if (message_count())
+		current_message(1);
+	else if (!ret)
+		info_msg("Compiler finished.");
+}
+
+bool compiler_running(void)
+{
+	return build_pid;
+}
+
 static void filter(int rfd, int wfd, struct filter_data *fdata)
 {
 	unsigned int wlen = 0;
@@ -147,20 +222,6 @@ static int open_dev_null(int flags)
 	return fd;
 }
 
-static int handle_child_error(int pid)
-{
-	int ret = wait_child(pid);
-
-	if (ret < 0) {
-		error_msg("waitpid: %s", strerror(errno));
-	} else if (ret >= 256) {
-		error_msg("Child received signal %d", ret >> 8);
-	} else if (ret) {
-		error_msg("Child returned %d", ret);
-	}
-	return ret;
-}
-
 int spawn_filter(char **argv, struct filter_data *data)
 {
 	int p0[2] = { -1, -1 };
@@ -247,6 +308,14 @@ void spawn_compiler(char **args, unsigned int flags, struct compiler *c)
 		error_msg("Error: %s", strerror(errno));
 		close(p[1]);
 		prompt = 0;
+	} else if (quiet) {
+		close(p[1]);
+		close(dev_null);
+		close(fd[0]);
+		build_compiler = c;
+		build_pid = pid;
+		watch_fd(p[0], build_output_ready);
+		return;
 	} else {
 		// Must close write end of the pipe before read_errors() or
 		// the read end never gets EOF!
@@ -21,6 +21,7 @@ struct filter_data {
 
 int spawn_filter(char **argv, struct filter_data *data);
 void spawn_compiler(char **args, unsigned int flags, struct compiler *c);
+bool compiler_running(void);
 void spawn(char **args, int fd[3], bool prompt);
 
 #endif
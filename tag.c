@@ -4,10 +4,37 @@
 #include "list.h"
 #include "ptr-array.h"
 #include "completion.h"
+#include "editor.h"
+#include "fork.h"
+#include "indexer.h"
+#include "options.h"
+#include "path.h"
 
-static struct tag_file *tag_file;
+// open tags files in search order, see tag_file_paths()
+static PTR_ARRAY(tag_files);
+
+// index of an unsorted tags file is built by a child process
+static int indexer_pid;
+static char *indexer_filename;
 static const char *current_filename; // for sorting tags
 
+// tag filenames are relative to the current directory or not normalized
+static bool in_current_file(const struct tag *t)
+{
+	const char *slash = strrchr(t->filename, '/');
+	const char *base = slash ? slash + 1 : t->filename;
+	char *abs;
+	bool ret;
+
+	// avoid resolving paths of files which can't be the current one
+	if (!current_filename || !streq(base, strrchr(current_filename, '/') + 1))
+		return false;
+	abs = path_absolute(t->filename);
+	ret = abs && streq(abs, current_filename);
+	free(abs);
+	return ret;
+}
+
 static int visibility_cmp(const struct tag *a, const struct tag *b)
 {
 	bool a_this_file = false;
@@ -18,9 +45,9 @@ static int visibility_cmp(const struct tag *a, const struct tag *b)
 
 	// Is tag visibility limited to the current file?
 	if (a->local)
-		a_this_file = current_filename && streq(current_filename, a->filename);
+		a_this_file = in_current_file(a);
 	if (b->local)
-		b_this_file = current_filename && streq(current_filename, b->filename);
+		b_this_file = in_current_file(b);
 
 	// Tags local to other file than current are not interesting.
 	if (a->local && !a_this_file) {
@@ -88,9 +115,7 @@ static int tag_cmp(const void *ap, const void *bp)
 
 static void sort_tags(struct ptr_array *tags)
 {
-	current_filename = NULL;
-	if (buffer->abs_filename)
-		current_filename = strrchr(buffer->abs_filename, '/') + 1;
+	current_filename = buffer->abs_filename;
 
 	qsort(tags->ptrs, tags->count, sizeof(tags->ptrs[0]), tag_cmp);
 }
@@ -98,21 +123,344 @@ static void sort_tags(struct ptr_array *tags)
 static int tag_file_changed(const char *filename, struct tag_file *tf)
 {
 	struct stat st;
-	stat(filename, &st);
-	return st.st_mtime != tf->mtime;
+
+	if (stat(filename, &st))
+		return 1;
+	return st.st_mtime != tf->mtime || st.st_size != tf->size || st.st_ino != tf->ino;
+}
+
+static char *tag_index_filename(struct tag_file *tf)
+{
+	char *dir = editor_file("tag-index");
+	char *filename = xsprintf("%s/%llx-%llx", dir,
+		(unsigned long long)tf->dev,
+		(unsigned long long)tf->ino);
+
+	free(dir);
+	return filename;
+}
+
+/*
+ * Index files are named after device and inode of the tags file so a
+ * regenerated tags file leaves its old index behind. Besides indexes of
+ * open tags files only this many are kept, least recently used ones are
+ * removed.
+ */
+#define MAX_TAG_INDEXES 32
+
+struct index_file {
+	char *filename;
+	time_t mtime;
+};
+
+static int index_file_cmp(const void *ap, const void *bp)
+{
+	const struct index_file *a = ap;
+	const struct index_file *b = bp;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return 0;
+}
+
+static bool is_open_tag_index(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < tag_files.count; i++) {
+		char *name = tag_index_filename(tag_files.ptrs[i]);
+		bool found = streq(name, filename);
+
+		free(name);
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+// called in the indexer process after a new index has been written
+static void prune_tag_indexes(void)
+{
+	char *dir = editor_file("tag-index");
+	struct index_file *files = NULL;
+	long i, nr = 0, alloc = 0;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		free(dir);
+		return;
+	}
+	while ((de = readdir(d))) {
+		char *filename;
+		struct stat st;
+
+		// *.tmp files can be written by other indexers right now
+		if (de->d_name[0] == '.' || strchr(de->d_name, '.'))
+			continue;
+		filename = xsprintf("%s/%s", dir, de->d_name);
+		if (stat(filename, &st) || is_open_tag_index(filename)) {
+			free(filename);
+			continue;
+		}
+		if (nr == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			xrenew(files, alloc);
+		}
+		files[nr].filename = filename;
+		files[nr++].mtime = st.st_mtime;
+	}
+	closedir(d);
+	free(dir);
+
+	qsort(files, nr, sizeof(*files), index_file_cmp);
+	for (i = 0; i < nr; i++) {
+		if (i < nr - MAX_TAG_INDEXES)
+			unlink(files[i].filename);
+		free(files[i].filename);
+	}
+	free(files);
+}
+
+static struct tag_file *find_tag_file(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < tag_files.count; i++) {
+		struct tag_file *tf = tag_files.ptrs[i];
+
+		if (streq(tf->filename, filename))
+			return tf;
+	}
+	return NULL;
+}
+
+static void indexer_done(int fd)
+{
+	struct tag_file *tf;
+	int status;
+
+	unwatch_fd(fd);
+	close(fd);
+	status = wait_child(indexer_pid);
+	indexer_pid = 0;
+
+	tf = find_tag_file(indexer_filename);
+	free(indexer_filename);
+	indexer_filename = NULL;
+	if (!tf || tf->index)
+		return;
+	if (status) {
+		// don't try again until the tags file changes
+		tf->index_failed = true;
+	} else {
+		// fails if the tags file changed while indexing
+		char *filename = tag_index_filename(tf);
+
+		load_tag_index(tf, filename);
+		free(filename);
+	}
+}
+
+static void start_indexer(struct tag_file *tf, const char *filename)
+{
+	char *dir = editor_file("tag-index");
+	int fd[2];
+	int pid;
+
+	mkdir(dir, 0700);
+	free(dir);
+
+	if (pipe_close_on_exec(fd))
+		return;
+	pid = fork();
+	if (pid < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	}
+	if (!pid) {
+		// parent sees EOF when the index is ready
+		bool ok;
+
+		close(fd[0]);
+		ok = write_tag_index(tf, filename);
+		prune_tag_indexes();
+		_exit(!ok);
+	}
+	close(fd[1]);
+	indexer_pid = pid;
+	indexer_filename = xstrdup(tf->filename);
+	watch_fd(fd[0], indexer_done);
+}
+
+/*
+ * Index of an unsorted tags file is loaded from the cache or built in the
+ * background. Lookups scan the whole file until the index is ready.
+ */
+static void load_tag_index_or_build(struct tag_file *tf)
+{
+	char *filename;
+
+	if (tf->sorted || tf->index || indexer_pid || tf->index_failed)
+		return;
+
+	filename = tag_index_filename(tf);
+	if (load_tag_index(tf, filename)) {
+		// recently used indexes are not pruned
+		utimes(filename, NULL);
+	} else {
+		start_indexer(tf, filename);
+	}
+	free(filename);
+}
+
+static bool same_dir(const char *a, const char *b)
+{
+	struct stat sa, sb;
+
+	return !stat(a, &sa) && !stat(b, &sb) && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/*
+ * Tags files in the current directory and its parent directories up to
+ * the root of the repository, then files listed in the tag-files option.
+ */
+static void tag_file_paths(struct ptr_array *paths)
+{
+	PTR_ARRAY(dirs);
+	const char *str = options.tag_files;
+	char *dir = xstrdup("");
+	int i;
+
+	while (dirs.count < 64) {
+		char *git = xsprintf("%s.git", dir);
+		char *dot = xsprintf("%s.", dir);
+		char *parent = xsprintf("%s..", dir);
+		struct stat st;
+		bool is_root = same_dir(dot, parent);
+		bool is_repo = !stat(git, &st);
+
+		free(git);
+		free(dot);
+		free(parent);
+		ptr_array_add(&dirs, dir);
+		if (is_repo) {
+			for (i = 0; i < dirs.count; i++)
+				ptr_array_add(paths, xsprintf("%stags", (char *)dirs.ptrs[i]));
+			break;
+		}
+		if (is_root) {
+			// not in a repository
+			ptr_array_add(paths, xstrdup("tags"));
+			break;
+		}
+		dir = xsprintf("%s../", dir);
+	}
+	ptr_array_free(&dirs);
+
+	while (str && *str) {
+		const char *end = strchr(str, ':');
+		int len = end ? end - str : strlen(str);
+
+		if (len)
+			ptr_array_add(paths, xstrslice(str, 0, len));
+		str += len;
+		if (*str)
+			str++;
+	}
+}
+
+static bool is_duplicate(struct ptr_array *files, struct tag_file *tf)
+{
+	int i;
+
+	for (i = 0; i < files->count; i++) {
+		struct tag_file *f = files->ptrs[i];
+
+		if (f->dev == tf->dev && f->ino == tf->ino)
+			return true;
+	}
+	return false;
 }
 
-static bool load_tag_file(void)
+static bool load_tag_files(void)
 {
-	if (tag_file && tag_file_changed("tags", tag_file)) {
-		close_tag_file(tag_file);
-		tag_file = NULL;
+	PTR_ARRAY(paths);
+	PTR_ARRAY(files);
+	int i;
+
+	tag_file_paths(&paths);
+	for (i = 0; i < paths.count; i++) {
+		const char *filename = paths.ptrs[i];
+		struct tag_file *tf = find_tag_file(filename);
+
+		if (tf) {
+			ptr_array_remove(&tag_files, ptr_array_idx(&tag_files, tf));
+			if (tag_file_changed(filename, tf)) {
+				close_tag_file(tf);
+				tf = NULL;
+			}
+		}
+		if (!tf)
+			tf = open_tag_file(filename);
+		if (!tf)
+			continue;
+		if (is_duplicate(&files, tf)) {
+			close_tag_file(tf);
+			continue;
+		}
+		load_tag_index_or_build(tf);
+		ptr_array_add(&files, tf);
 	}
-	if (tag_file)
-		return true;
+	ptr_array_free(&paths);
+
+	// close files which are not in the search path anymore
+	for (i = 0; i < tag_files.count; i++)
+		close_tag_file(tag_files.ptrs[i]);
+	free(tag_files.ptrs);
+	tag_files = files;
+	return tag_files.count;
+}
+
+// filenames in a tags file are relative to the directory of the tags file
+static void fix_filename(const struct tag_file *tf, struct tag *t)
+{
+	const char *slash = strrchr(tf->filename, '/');
+	char *filename;
 
-	tag_file = open_tag_file("tags");
-	return !!tag_file;
+	if (!slash || t->filename[0] == '/')
+		return;
+	filename = xsprintf("%.*s%s", (int)(slash - tf->filename + 1), tf->filename, t->filename);
+	free(t->filename);
+	t->filename = filename;
+}
+
+/*
+ * Every tags file is searched using its own sort order or index and the
+ * results are merged.
+ */
+static bool find_all_tags(const char *prefix, int exact, struct ptr_array *tags)
+{
+	bool found = load_tag_files();
+	int i;
+
+	for (i = 0; i < tag_files.count; i++) {
+		struct tag_file *tf = tag_files.ptrs[i];
+		struct tag *t = xnew(struct tag, 1);
+		size_t pos = 0;
+
+		while (next_tag(tf, &pos, prefix, exact, t)) {
+			fix_filename(tf, t);
+			ptr_array_add(tags, t);
+			t = xnew(struct tag, 1);
+		}
+		free(t);
+	}
+	if (find_indexed_tags(prefix, exact, tags))
+		found = true;
+	return found;
 }
 
 void free_tags(struct ptr_array *tags)
@@ -129,37 +477,36 @@ void free_tags(struct ptr_array *tags)
 
 bool find_tags(const char *name, struct ptr_array *tags)
 {
-	struct tag *t;
-	size_t pos = 0;
-
-	if (!load_tag_file())
+	if (!find_all_tags(name, 1, tags))
 		return false;
-
-	t = xnew(struct tag, 1);
-	while (next_tag(tag_file, &pos, name, 1, t)) {
-		ptr_array_add(tags, t);
-		t = xnew(struct tag, 1);
-	}
-	free(t);
 	sort_tags(tags);
 	return true;
 }
 
+static int name_cmp(const void *ap, const void *bp)
+{
+	const struct tag *a = *(const struct tag **)ap;
+	const struct tag *b = *(const struct tag **)bp;
+
+	return strcmp(a->name, b->name);
+}
+
 void collect_tags(const char *prefix)
 {
-	struct tag t;
-	size_t pos = 0;
-	char *prev = NULL;
+	PTR_ARRAY(tags);
+	const char *prev = NULL;
+	int i;
 
-	if (!load_tag_file())
-		return;
+	find_all_tags(prefix, 0, &tags);
+	qsort(tags.ptrs, tags.count, sizeof(tags.ptrs[0]), name_cmp);
+	for (i = 0; i < tags.count; i++) {
+		struct tag *t = tags.ptrs[i];
 
-	while (next_tag(tag_file, &pos, prefix, 0, &t)) {
-		if (!prev || strcmp(prev, t.name)) {
-			add_completion(t.name);
-			prev = t.name;
-			t.name = NULL;
-		}
-		free_tag(&t);
+		if (prev && streq(prev, t->name))
+			continue;
+		add_completion(t->name);
+		prev = t->name;
+		t->name = NULL;
 	}
+	free_tags(&tags);
 }
@@ -9,6 +9,7 @@
 #include <termios.h>
 
 struct term_cap term_cap;
+bool term_sync_supported;
 
 static struct termios termios_save;
 static char buffer[64];
@@ -138,10 +139,26 @@ void term_cooked(void)
 	tcsetattr(0, 0, &termios_save);
 }
 
-static char input_buf[256];
+// big enough to read pasted text in large chunks
+static char input_buf[64 * 1024];
 static int input_buf_fill;
 static bool input_can_be_truncated;
 
+// bracketed paste mode, pasted text is surrounded with these
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+#define PASTE_MARKER_LEN 6
+
+// reading text between PASTE_START and PASTE_END
+static bool bracketed_paste;
+
+// DECRQM query for mode 2026 and start of the DECRPM reply, which is
+// followed by the state (0 unknown mode, 1 set, 2 reset, 3 or 4
+// permanently set or reset) and "$y"
+#define SYNC_QUERY "\033[?2026$p"
+#define SYNC_REPORT "\033[?2026;"
+#define SYNC_REPORT_LEN 11
+
 static void consume_input(int len)
 {
 	input_buf_fill -= len;
@@ -187,6 +204,19 @@ static bool fill_buffer_timeout(void)
 	return false;
 }
 
+// true if a key can be read without blocking
+bool term_input_pending(void)
+{
+	struct timeval tv = { 0, 0 };
+	fd_set set;
+
+	if (input_buf_fill)
+		return true;
+	FD_ZERO(&set);
+	FD_SET(0, &set);
+	return select(1, &set, NULL, NULL, &tv) > 0;
+}
+
 static bool input_get_byte(unsigned char *ch)
 {
 	if (!input_buf_fill && !fill_buffer())
@@ -326,11 +356,47 @@ static bool is_text(const char *str, int len)
 	return true;
 }
 
+// consumes reply to term_query_sync()
+static bool read_sync_report(void)
+{
+	int prefix = sizeof(SYNC_REPORT) - 1;
+
+	// keys don't start with "\033[?"
+	if (input_buf_fill >= 3 && input_buf_fill < SYNC_REPORT_LEN &&
+	    !memcmp(input_buf, SYNC_REPORT, input_buf_fill < prefix ? input_buf_fill : prefix)) {
+		// possibly truncated
+		fill_buffer_timeout();
+	}
+	if (input_buf_fill < SYNC_REPORT_LEN || memcmp(input_buf, SYNC_REPORT, prefix))
+		return false;
+	if (memcmp(input_buf + prefix + 1, "$y", 2))
+		return false;
+	term_sync_supported = input_buf[prefix] == '1' || input_buf[prefix] == '2';
+	consume_input(SYNC_REPORT_LEN);
+	return true;
+}
+
 bool term_read_key(unsigned int *key, enum term_key_type *type)
 {
 	if (!input_buf_fill && !fill_buffer())
 		return false;
 
+	if (input_buf[0] == '\033' && read_sync_report())
+		return false;
+
+	if (input_buf[0] == '\033' && input_buf_fill < PASTE_MARKER_LEN &&
+	    !memcmp(input_buf, PASTE_START, input_buf_fill)) {
+		// possibly truncated
+		fill_buffer_timeout();
+	}
+	if (input_buf_fill >= PASTE_MARKER_LEN && !memcmp(input_buf, PASTE_START, PASTE_MARKER_LEN)) {
+		consume_input(PASTE_MARKER_LEN);
+		bracketed_paste = true;
+		*key = 0;
+		*type = KEY_PASTE;
+		return true;
+	}
+
 	if (input_buf_fill > 4 && is_text(input_buf, input_buf_fill)) {
 		*key = 0;
 		*type = KEY_PASTE;
@@ -379,49 +445,89 @@ bool term_read_key(unsigned int *key, enum term_key_type *type)
 	return read_simple(key, type);
 }
 
+// returns number of bytes available before PASTE_END, -1 if more input needed
+static long bracketed_paste_avail(void)
+{
+	const char *esc = memchr(input_buf, '\033', input_buf_fill);
+	long n;
+
+	if (!esc)
+		return input_buf_fill;
+	if (esc > input_buf)
+		return esc - input_buf;
+
+	n = input_buf_fill < PASTE_MARKER_LEN ? input_buf_fill : PASTE_MARKER_LEN;
+	if (memcmp(input_buf, PASTE_END, n)) {
+		// escape character inside pasted text
+		return 1;
+	}
+	if (n < PASTE_MARKER_LEN)
+		return -1;
+	consume_input(PASTE_MARKER_LEN);
+	bracketed_paste = false;
+	return 0;
+}
+
+/*
+ * Reads next part of pasted text to buf. Returns 0 when the whole paste
+ * has been read. Without bracketed paste mode the paste ends when no more
+ * input is immediately available.
+ */
+long term_read_paste_chunk(char *buf, long size)
+{
+	long i, count;
+
+	while (1) {
+		if (!input_buf_fill) {
+			if (!bracketed_paste && !term_input_pending())
+				return 0;
+			if (!fill_buffer()) {
+				bracketed_paste = false;
+				return 0;
+			}
+		}
+		if (!bracketed_paste) {
+			count = input_buf_fill;
+			break;
+		}
+		count = bracketed_paste_avail();
+		if (count >= 0)
+			break;
+		if (!fill_buffer()) {
+			bracketed_paste = false;
+			return 0;
+		}
+	}
+	if (count > size)
+		count = size;
+	memcpy(buf, input_buf, count);
+	consume_input(count);
+
+	for (i = 0; i < count; i++) {
+		if (buf[i] == '\r')
+			buf[i] = '\n';
+	}
+	return count;
+}
+
 char *term_read_paste(long *size)
 {
-	long alloc = ROUND_UP(input_buf_fill + 1, 1024);
+	long alloc = 4096;
 	long count = 0;
-	long i;
 	char *buf = xmalloc(alloc);
 
-	if (input_buf_fill) {
-		memcpy(buf, input_buf, input_buf_fill);
-		count = input_buf_fill;
-		input_buf_fill = 0;
-	}
 	while (1) {
-		struct timeval tv = {
-			.tv_sec = 0,
-			.tv_usec = 0
-		};
-		fd_set set;
-		int rc;
-
-		FD_ZERO(&set);
-		FD_SET(0, &set);
-		rc = select(1, &set, NULL, NULL, &tv);
-		if (rc < 0 && errno == EINTR)
-			continue;
-		if (rc <= 0)
-			break;
+		long rc;
 
-		if (alloc - count < 256) {
+		if (alloc - count < 1024) {
 			alloc *= 2;
 			xrenew(buf, alloc);
 		}
-		do {
-			rc = read(0, buf + count, alloc - count);
-		} while (rc < 0 && errno == EINTR);
-		if (rc <= 0)
+		rc = term_read_paste_chunk(buf + count, alloc - count);
+		if (!rc)
 			break;
 		count += rc;
 	}
-	for (i = 0; i < count; i++) {
-		if (buf[i] == '\r')
-			buf[i] = '\n';
-	}
 	*size = count;
 	return buf;
 }
@@ -459,7 +565,13 @@ static void buffer_color(char x, unsigned char color)
 	}
 }
 
-const char *term_set_color(const struct term_color *color)
+static void buffer_attr(char ch)
+{
+	buffer[buffer_pos++] = ';';
+	buffer[buffer_pos++] = ch;
+}
+
+static struct term_color normalize_color(const struct term_color *color)
 {
 	struct term_color c = *color;
 
@@ -469,46 +581,90 @@ const char *term_set_color(const struct term_color *color)
 		c.attr |= ATTR_BOLD;
 		c.fg &= 7;
 	}
+	// -2 (keep) is treated as -1 (default)
+	if (c.fg < 0)
+		c.fg = -1;
+	if (c.bg < 0)
+		c.bg = -1;
+	c.attr &= ~ATTR_KEEP;
+	return c;
+}
+
+/*
+ * Returns escape sequence which changes color from prev to color, or
+ * from anything to color if prev is NULL. Attributes can't be turned
+ * off one by one portably so the sequence starts with a reset if any
+ * attribute needs to be removed.
+ */
+const char *term_set_color(const struct term_color *color, const struct term_color *prev)
+{
+	struct term_color c = normalize_color(color);
+	struct term_color p = { -1, -1, 0 };
+	unsigned short attr;
+
+	if (prev)
+		p = normalize_color(prev);
 
 	// max 35 bytes (3 + 6 * 2 + 2 * 9 + 2)
 	buffer_pos = 0;
 	buffer[buffer_pos++] = '\033';
 	buffer[buffer_pos++] = '[';
-	buffer[buffer_pos++] = '0';
 
-	if (c.attr & ATTR_BOLD) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '1';
-	}
-	if (c.attr & ATTR_LOW_INTENSITY) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '2';
+	if (!prev || (p.attr & ~c.attr)) {
+		buffer[buffer_pos++] = '0';
+		p.fg = -1;
+		p.bg = -1;
+		p.attr = 0;
 	}
-	if (c.attr & ATTR_UNDERLINE) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '4';
+
+	attr = c.attr & ~p.attr;
+	if (attr & ATTR_BOLD)
+		buffer_attr('1');
+	if (attr & ATTR_LOW_INTENSITY)
+		buffer_attr('2');
+	if (attr & ATTR_UNDERLINE)
+		buffer_attr('4');
+	if (attr & ATTR_BLINKING)
+		buffer_attr('5');
+	if (attr & ATTR_REVERSE_VIDEO)
+		buffer_attr('7');
+	if (attr & ATTR_INVISIBLE_TEXT)
+		buffer_attr('8');
+	if (c.fg != p.fg) {
+		if (c.fg >= 0) {
+			buffer_color('3', c.fg);
+		} else {
+			buffer_attr('3');
+			buffer[buffer_pos++] = '9';
+		}
 	}
-	if (c.attr & ATTR_BLINKING) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '5';
+	if (c.bg != p.bg) {
+		if (c.bg >= 0) {
+			buffer_color('4', c.bg);
+		} else {
+			buffer_attr('4');
+			buffer[buffer_pos++] = '9';
+		}
 	}
-	if (c.attr & ATTR_REVERSE_VIDEO) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '7';
+	if (buffer_pos == 2) {
+		// nothing changed
+		return "";
 	}
-	if (c.attr & ATTR_INVISIBLE_TEXT) {
-		buffer[buffer_pos++] = ';';
-		buffer[buffer_pos++] = '8';
+	if (buffer[2] == ';') {
+		// no reset, drop leading separator
+		memmove(buffer + 2, buffer + 3, buffer_pos - 3);
+		buffer_pos--;
 	}
-	if (c.fg >= 0)
-		buffer_color('3', c.fg);
-	if (c.bg >= 0)
-		buffer_color('4', c.bg);
 	buffer[buffer_pos++] = 'm';
 	buffer[buffer_pos++] = 0;
 	return buffer;
 }
 
+const char *term_query_sync(void)
+{
+	return SYNC_QUERY;
+}
+
 const char *term_move_cursor(int x, int y)
 {
 	if (x < 0 || x >= 999 || y < 0 || y >= 999)
@@ -527,3 +683,72 @@ const char *term_move_cursor(int x, int y)
 	buffer[buffer_pos++] = 0;
 	return buffer;
 }
+
+/*
+ * Expand parameters of a string capability. Handles the terminfo
+ * (%p1%d) and termcap (%d) forms used by real terminals.
+ */
+static const char *expand_cap(const char *fmt, int p1, int p2)
+{
+	int params[2] = { p1, p2 };
+	int stack[4], sp = 0, next = 0;
+
+	if (fmt == NULL)
+		return NULL;
+
+	buffer_pos = 0;
+	while (*fmt) {
+		char ch = *fmt++;
+
+		if (ch == '$' && *fmt == '<') {
+			// padding
+			while (*fmt && *fmt++ != '>')
+				;
+			continue;
+		}
+		if (buffer_pos > sizeof(buffer) - 12)
+			return NULL;
+		if (ch != '%') {
+			buffer[buffer_pos++] = ch;
+			continue;
+		}
+		ch = *fmt++;
+		switch (ch) {
+		case '%':
+			buffer[buffer_pos++] = '%';
+			break;
+		case 'i':
+			params[0]++;
+			params[1]++;
+			break;
+		case 'p':
+			if (*fmt < '1' || *fmt > '2' || sp == ARRAY_COUNT(stack))
+				return NULL;
+			stack[sp++] = params[*fmt++ - '1'];
+			break;
+		case 'd':
+			if (sp) {
+				buffer_num(stack[--sp]);
+			} else if (next < 2) {
+				buffer_num(params[next++]);
+			} else {
+				return NULL;
+			}
+			break;
+		default:
+			return NULL;
+		}
+	}
+	buffer[buffer_pos] = 0;
+	return buffer;
+}
+
+const char *term_scroll_region(int top, int bottom)
+{
+	return expand_cap(term_cap.strings[STR_CAP_CMD_cs], top, bottom);
+}
+
+const char *term_cursor_forward(int count)
+{
+	return expand_cap(term_cap.strings[STR_CAP_CMD_RI], count, 0);
+}
@@ -20,14 +20,20 @@ enum term_key_type {
 enum {
 	STR_CAP_CMD_ac, // pairs of block graphic characters to map alternate character set
 	STR_CAP_CMD_ae, // end alternative character set
+	STR_CAP_CMD_al, // insert line
 	STR_CAP_CMD_as, // start alternative character set for block graphic characters
 	STR_CAP_CMD_ce, // clear to end of line
+	STR_CAP_CMD_cs, // set scroll region (parameters: top and bottom line)
+	STR_CAP_CMD_dl, // delete line
 	STR_CAP_CMD_ke, // turn keypad off
 	STR_CAP_CMD_ks, // turn keypad on
+	STR_CAP_CMD_sf, // scroll forward (up) one line
+	STR_CAP_CMD_sr, // scroll reverse (down) one line
 	STR_CAP_CMD_te, // end program that uses cursor motion
 	STR_CAP_CMD_ti, // begin program that uses cursor motion
 	STR_CAP_CMD_ve, // show cursor
 	STR_CAP_CMD_vi, // hide cursor
+	STR_CAP_CMD_RI, // move cursor right (parameter: count)
 
 	NR_STR_CAP_CMDS
 };
@@ -107,6 +113,9 @@ struct term_color {
 
 extern struct term_cap term_cap;
 
+// terminal reported support for synchronized output (DEC mode 2026)
+extern bool term_sync_supported;
+
 // control key
 #define CTRL(x) ((x) & ~0x40)
 
@@ -115,17 +124,28 @@ int term_init(bool use_terminfo, bool use_termcap);
 void term_raw(void);
 void term_cooked(void);
 
+bool term_input_pending(void);
 bool term_read_key(unsigned int *key, enum term_key_type *type);
+long term_read_paste_chunk(char *buf, long size);
 char *term_read_paste(long *size);
 void term_discard_paste(void);
 
 int term_get_size(int *w, int *h);
 
-const char *term_set_color(const struct term_color *color);
+/* ask terminal whether it supports synchronized output */
+const char *term_query_sync(void);
+
+const char *term_set_color(const struct term_color *color, const struct term_color *prev);
 
 /* move cursor (x and y are zero based) */
 const char *term_move_cursor(int x, int y);
 
+/* set scroll region (zero based, inclusive), NULL if not supported */
+const char *term_scroll_region(int top, int bottom);
+
+/* move cursor count columns right, NULL if not supported */
+const char *term_cursor_forward(int count);
+
 /* private - don't use */
 int termcap_get_caps(const char *filename, const char *term);
 int terminfo_get_caps(const char *filename);
@@ -5,14 +5,20 @@ static const char str_cap_names[NR_STR_CAPS * 2] =
 	// commands
 	"ac"
 	"ae"
+	"al"
 	"as"
 	"ce"
+	"cs"
+	"dl"
 	"ke"
 	"ks"
+	"sf"
+	"sr"
 	"te"
 	"ti"
 	"ve"
 	"vi"
+	"RI"
 
 	// keys
 	"kI"
@@ -5,14 +5,20 @@
 static unsigned char string_cap_map[NR_STR_CAPS] = {
 	tcs_acs_chars,
 	tcs_exit_alt_charset_mode,
+	tcs_insert_line,
 	tcs_enter_alt_charset_mode,
 	tcs_clr_eol,
+	tcs_change_scroll_region,
+	tcs_delete_line,
 	tcs_keypad_local,
 	tcs_keypad_xmit,
+	tcs_scroll_forward,
+	tcs_scroll_reverse,
 	tcs_exit_ca_mode,
 	tcs_enter_ca_mode,
 	tcs_cursor_normal,
 	tcs_cursor_invisible,
+	tcs_parm_right_cursor,
 
 	tcs_key_ic,
 	tcs_key_dc,
@@ -1,6 +1,12 @@
 #include "editor.h"
 #include "common.h"
 #include "path.h"
+#include "lz.h"
+#include "ctags.h"
+#include "indexer.h"
+#include "words.h"
+#include "follow.h"
+#include "block.h"
 
 #include <locale.h>
 #include <langinfo.h>
@@ -39,6 +45,292 @@ static void test_relative_filename(void)
 	}
 }
 
+static void test_lz(void)
+{
+	static const char * const tests[] = {
+		"",
+		"a",
+		"abcabcabcabcabcabcabcabc",
+		"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+		"static void test_lz(void)\n{\n}\n\nstatic void test_lz(void)\n{\n}\n",
+	};
+	char buf[4096], out[4096];
+	long size;
+	int i;
+
+	for (i = 0; i < ARRAY_COUNT(tests); i++) {
+		long len = strlen(tests[i]);
+
+		size = lz_compress(tests[i], len, buf);
+		if (size > lz_bound(len))
+			fail("lz_compress(\"%s\") exceeded bound\n", tests[i]);
+		if (!lz_decompress(buf, size, out, len) || memcmp(out, tests[i], len))
+			fail("lz_decompress() failed for \"%s\"\n", tests[i]);
+	}
+
+	// long literal and match lengths, incompressible data
+	for (i = 0; i < 2048; i++)
+		out[i] = i < 1024 ? (i * 7919) >> 3 : out[i - 1024];
+	size = lz_compress(out, 2048, buf);
+	if (size > lz_bound(2048) || size > 1200)
+		fail("lz_compress() returned %ld\n", size);
+	if (!lz_decompress(buf, size, out + 2048, 2048) || memcmp(out, out + 2048, 2048))
+		fail("lz_decompress() failed for long lengths\n");
+
+	// truncated data must be detected
+	if (lz_decompress(buf, size / 2, out + 2048, 2048))
+		fail("lz_decompress() accepted truncated data\n");
+}
+
+static int count_tags(struct tag_file *tf, const char *prefix, int exact)
+{
+	struct tag t;
+	size_t pos = 0;
+	int count = 0;
+
+	while (next_tag(tf, &pos, prefix, exact, &t)) {
+		free_tag(&t);
+		count++;
+	}
+	return count;
+}
+
+static void test_next_tag(void)
+{
+	static const char sorted[] =
+		"!_TAG_FILE_FORMAT\t2\t/extended format/\n"
+		"!_TAG_FILE_SORTED\t1\t/0=unsorted, 1=sorted, 2=foldcase/\n"
+		"A\ta.c\t1;\"\tv\n"
+		"abc\ta.c\t2;\"\tf\n"
+		"abc\tb.c\t3;\"\tf\n"
+		"abc_d\ta.c\t4;\"\tf\n"
+		"abcd\ta.c\t5;\"\tf\n"
+		"b\ta.c\t6;\"\tf\n";
+	static const char foldcase[] =
+		"!_TAG_FILE_SORTED\t2\t/0=unsorted, 1=sorted, 2=foldcase/\n"
+		"a\ta.c\t1;\"\tv\n"
+		"ABC\ta.c\t2;\"\tf\n"
+		"abc\tb.c\t3;\"\tf\n"
+		"Abcd\ta.c\t4;\"\tf\n"
+		"abc_d\ta.c\t5;\"\tf\n"
+		"B\ta.c\t6;\"\tf\n";
+	static const struct {
+		const char *prefix;
+		int exact;
+	} tests[] = {
+		{ "", 0 },
+		{ "a", 0 },
+		{ "a", 1 },
+		{ "A", 1 },
+		{ "abc", 0 },
+		{ "abc", 1 },
+		{ "abcd", 1 },
+		{ "ABC", 1 },
+		{ "b", 0 },
+		{ "B", 0 },
+		{ "c", 0 },
+	};
+	const char *files[] = { sorted, foldcase };
+	int i, j;
+
+	for (i = 0; i < ARRAY_COUNT(files); i++) {
+		struct tag_file tf = { (char *)files[i], strlen(files[i]), 0, i + 1 };
+		struct tag_file unsorted = tf;
+		struct tag_file indexed;
+		char *index;
+		long size;
+
+		unsorted.sorted = 0;
+		indexed = unsorted;
+		index = build_tag_index(&indexed, &size);
+		if (!set_tag_index(&indexed, index, size))
+			fail("set_tag_index() rejected index\n");
+		for (j = 0; j < ARRAY_COUNT(tests); j++) {
+			int a = count_tags(&tf, tests[j].prefix, tests[j].exact);
+			int b = count_tags(&unsorted, tests[j].prefix, tests[j].exact);
+			int c = count_tags(&indexed, tests[j].prefix, tests[j].exact);
+
+			if (a != b)
+				fail("next_tag(%s, %d) found %d tags in sorted file, expected %d\n", tests[j].prefix, tests[j].exact, a, b);
+			if (c != b)
+				fail("next_tag(%s, %d) found %d tags using index, expected %d\n", tests[j].prefix, tests[j].exact, c, b);
+		}
+		free(index);
+	}
+}
+
+static void test_scan_tags(void)
+{
+	static const char c[] =
+		"#define MAX 10\n"
+		"/* int commented(void)\n"
+		"{ */\n"
+		"struct point {\n"
+		"\tint x, y;\n"
+		"};\n"
+		"typedef struct {\n"
+		"\tint a;\n"
+		"} pair;\n"
+		"typedef int (*callback)(void);\n"
+		"int prototype(int a);\n"
+		"static int helper(int a,\n"
+		"\tint b)\n"
+		"{\n"
+		"\treturn call(a);\n"
+		"}\n";
+	static const char c_tags[] =
+		"MAX\ta.c\t1;\"\td\n"
+		"point\ta.c\t4;\"\ts\n"
+		"pair\ta.c\t9;\"\tt\n"
+		"callback\ta.c\t10;\"\tt\n"
+		"helper\ta.c\t12;\"\tf\tfile:\n";
+	static const char go[] =
+		"func main() {\n"
+		"func (s *server) serve(c conn) {\n"
+		"type server struct {\n";
+	static const char go_tags[] =
+		"main\ta.go\t1;\"\tf\n"
+		"serve\ta.go\t2;\"\tf\n"
+		"server\ta.go\t3;\"\tt\n";
+	static const char py[] =
+		"class Foo:\n"
+		"    def bar(self):\n"
+		"def baz():\n";
+	static const char py_tags[] =
+		"Foo\ta.py\t1;\"\tc\n"
+		"bar\ta.py\t2;\"\tm\n"
+		"baz\ta.py\t3;\"\tf\n";
+	static const struct {
+		const char *filename;
+		const char *text;
+		const char *tags;
+	} tests[] = {
+		{ "a.c", c, c_tags },
+		{ "a.go", go, go_tags },
+		{ "a.py", py, py_tags },
+		{ "a.txt", c, "" },
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_COUNT(tests); i++) {
+		GBUF(out);
+
+		scan_tags(tests[i].filename, tests[i].text, strlen(tests[i].text), &out);
+		if (out.len != strlen(tests[i].tags) || memcmp(out.buffer, tests[i].tags, out.len))
+			fail("scan_tags(%s) returned:\n%.*s", tests[i].filename, (int)out.len, out.buffer);
+		gbuf_free(&out);
+	}
+}
+
+static void test_find_words(void)
+{
+	static const char text[] = "foo fooba foobar\nfoobar(fo, 2foo) foo_bar fooba foobar\n";
+	// foo_bar was deleted
+	static const char *expected[] = { "foobar", "fooba" };
+	PTR_ARRAY(found);
+	int i;
+
+	add_words(text, strlen(text), 1);
+	add_words("foo_bar\n", 8, -1);
+	find_words("foo", 3, &found);
+	if (found.count == ARRAY_COUNT(expected)) {
+		for (i = 0; i < found.count; i++) {
+			if (strcmp(found.ptrs[i], expected[i]))
+				fail("find_words: %s, expected %s\n", (char *)found.ptrs[i], expected[i]);
+		}
+	} else {
+		fail("find_words: %ld words, expected %d\n", found.count, (int)ARRAY_COUNT(expected));
+	}
+	ptr_array_free(&found);
+	add_words(text, strlen(text), -1);
+}
+
+static void check_buffer(struct buffer *b, const char *expected)
+{
+	GBUF(buf);
+	struct block *blk;
+
+	list_for_each_entry(blk, &b->blocks, node)
+		gbuf_add_buf(&buf, blk->data, blk->size);
+	if (buf.len != strlen(expected) || memcmp(buf.buffer, expected, buf.len))
+		fail("followed buffer contains \"%.*s\", expected \"%s\"\n", (int)buf.len, buf.buffer, expected);
+	gbuf_free(&buf);
+}
+
+static void test_follow_truncate(void)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	char *filename = xsprintf("%s/dex-test-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+	struct buffer *b = xnew0(struct buffer, 1);
+	int fd = mkstemp(filename);
+
+	if (fd < 0) {
+		fail("mkstemp: %s\n", strerror(errno));
+		free(filename);
+		return;
+	}
+	xwrite(fd, "a\nb\n", 4);
+	list_init(&b->blocks);
+	list_add_before(&block_new(1)->node, &b->blocks);
+	b->cur_change = &b->change_head;
+	b->saved_change = &b->change_head;
+	b->encoding = xstrdup("UTF-8");
+	b->abs_filename = xstrdup(filename);
+
+	append_new_lines(b);
+	check_buffer(b, "a\nb\n");
+	xwrite(fd, "c\nd", 3);
+	append_new_lines(b);
+	check_buffer(b, "a\nb\nc\n");
+
+	// lines are not duplicated when the file is truncated and rewritten
+	if (ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET))
+		fail("ftruncate: %s\n", strerror(errno));
+	xwrite(fd, "x\n", 2);
+	append_new_lines(b);
+	check_buffer(b, "x\n");
+	if (b->nl != 1)
+		fail("followed buffer has %ld lines, expected 1\n", b->nl);
+
+	close(fd);
+	unlink(filename);
+	free(filename);
+}
+
+static void test_marks(void)
+{
+	static const long offsets[] = { 0, 5, 10, 10, 20, 30 };
+	// insert 3 at 10, delete 8 at 4, replace 2 at 12 with 5
+	static const long expected[] = { 0, 4, 4, 4, 18, 28 };
+	struct buffer *b = xnew0(struct buffer, 1);
+	struct mark marks[ARRAY_COUNT(offsets)];
+	struct mark extra;
+	int i;
+
+	for (i = 0; i < ARRAY_COUNT(offsets); i++)
+		mark_add(b, &marks[i], offsets[i]);
+	update_marks(b, 10, 0, 3);
+	update_marks(b, 4, 8, 0);
+	update_marks(b, 12, 2, 5);
+	for (i = 0; i < ARRAY_COUNT(offsets); i++) {
+		if (mark_offset(&marks[i]) != expected[i])
+			fail("mark %d at %ld, expected %ld\n", i, mark_offset(&marks[i]), expected[i]);
+	}
+
+	// adding a mark applies pending shifts
+	mark_add(b, &extra, 5);
+	if (extra.idx != 4 || mark_offset(&marks[5]) != 28)
+		fail("mark added at index %ld\n", extra.idx);
+	mark_remove(&marks[1]);
+	for (i = 0; i < b->marks.count; i++) {
+		struct mark *m = b->marks.ptrs[i];
+		if (m->idx != i || (i && mark_offset(b->marks.ptrs[i - 1]) > mark_offset(m)))
+			fail("marks out of order at %d\n", i);
+	}
+	detach_marks(b);
+	free(b);
+}
+
 int main(int argc, char *argv[])
 {
 	const char *home = getenv("HOME");
@@ -53,5 +345,11 @@ int main(int argc, char *argv[])
 		term_utf8 = true;
 
 	test_relative_filename();
+	test_lz();
+	test_next_tag();
+	test_scan_tags();
+	test_find_words();
+	test_follow_truncate();
+	test_marks();
 	return 0;
 }
@@ -0,0 +1,441 @@
+#include "undo-file.h"
+#include "change.h"
+#include "editor.h"
+#include "error.h"
+#include "gbuf.h"
+#include "common.h"
+
+#include <sys/mman.h>
+
+/*
+ * Undo history of a file is saved to ~/.dex/undo/HASH when its buffer is
+ * closed and read back on the first undo, redo or edit after the file has
+ * been opened again.
+ *
+ * File format:
+ *
+ *     struct undo_header
+ *     filename, padded to multiple of sizeof(long)
+ *     struct undo_record[nr_records]
+ *     (struct change_edit[nr_edits], deleted bytes)...
+ *
+ * Deleted bytes are compressed like in memory.
+ *
+ * Records are in breadth-first order starting from the change head so
+ * every change comes after the change it follows. Nothing but the records
+ * need to be parsed to rebuild the tree and the history is used only if
+ * the text it applies to is still the same.
+ *
+ * Opening a file costs nothing, the undo file is read on first use. Then
+ * the whole file is read at once: records are checked against the size
+ * of the buffer they apply to and every payload is copied, still
+ * compressed, so the first use costs hashing the buffer plus time linear
+ * in the size of the undo file. Compressed text is not decompressed until
+ * its change is undone or redone and a corrupted payload makes only that
+ * undo or redo fail.
+ */
+
+#define UNDO_MAGIC "dex-undo"
+#define UNDO_VERSION 2
+
+#define UNDO_MOVE_AFTER 1
+#define UNDO_COMPRESSED 2
+
+struct undo_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int record_size;
+	unsigned long long content_hash;
+	long content_size;
+	long nr_records;
+	long cur;
+	long filename_len;
+};
+
+struct undo_record {
+	// index of the older change, -1 for the change head
+	long next;
+	long offset;
+	long del_count;
+	long ins_count;
+	long nr_edits;
+	// edits followed by data_size deleted bytes
+	long data_offset;
+	long data_size;
+	unsigned int flags;
+};
+
+static char *undo_filename(const char *abs_filename)
+{
+	// FNV-1a
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	char *dir, *filename;
+	int i;
+
+	for (i = 0; abs_filename[i]; i++) {
+		hash ^= (unsigned char)abs_filename[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	dir = editor_file("undo");
+	filename = xsprintf("%s/%016llx", dir, hash);
+	free(dir);
+	return filename;
+}
+
+static unsigned long long content_hash(struct buffer *b, long *size)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	struct block *blk;
+
+	*size = 0;
+	list_for_each_entry(blk, &b->blocks, node) {
+		const unsigned char *data = (const unsigned char *)blk->data;
+		long i;
+
+		for (i = 0; i < blk->size; i++) {
+			hash ^= data[i];
+			hash *= 0x100000001b3ULL;
+		}
+		*size += blk->size;
+	}
+	return hash;
+}
+
+static long padded(long size)
+{
+	return (size + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+}
+
+void save_undo_file(struct buffer *b)
+{
+	struct change *head = &b->change_head;
+	struct gbuf buf = GBUF_INIT;
+	struct undo_header h;
+	PTR_ARRAY(changes);
+	long *parents = NULL;
+	long i, alloc = 0, data_offset = 0;
+	char *filename, *tmp, *dir;
+	int fd;
+
+	if (!b->abs_filename || buffer_incomplete(b) || buffer_modified(b) || !head->nr_prev)
+		return;
+	if (!b->undo_file_loaded && b->cur_change == head) {
+		// nothing was changed, keep the history which was never loaded
+		return;
+	}
+
+	ptr_array_add(&changes, head);
+	for (i = 0; i < changes.count; i++) {
+		struct change *c = changes.ptrs[i];
+		unsigned int j;
+
+		if (changes.count + c->nr_prev > alloc) {
+			alloc = (changes.count + c->nr_prev) * 2;
+			xrenew(parents, alloc);
+		}
+		for (j = 0; j < c->nr_prev; j++) {
+			parents[changes.count] = i;
+			ptr_array_add(&changes, c->prev[j]);
+		}
+	}
+
+	clear(&h);
+	memcpy(h.magic, UNDO_MAGIC, sizeof(h.magic));
+	h.version = UNDO_VERSION;
+	h.record_size = sizeof(struct undo_record);
+	h.content_hash = content_hash(b, &h.content_size);
+	h.nr_records = changes.count;
+	h.filename_len = strlen(b->abs_filename);
+	for (i = 0; i < changes.count; i++) {
+		if (changes.ptrs[i] == b->cur_change)
+			h.cur = i;
+	}
+	gbuf_add_buf(&buf, (const char *)&h, sizeof(h));
+	gbuf_add_buf(&buf, b->abs_filename, h.filename_len);
+	gbuf_grow(&buf, padded(h.filename_len) - h.filename_len);
+	memset(buf.buffer + buf.len, 0, padded(h.filename_len) - h.filename_len);
+	buf.len += padded(h.filename_len) - h.filename_len;
+
+	for (i = 0; i < changes.count; i++) {
+		struct change *c = changes.ptrs[i];
+		struct undo_record r;
+
+		clear(&r);
+		r.next = i ? parents[i] : -1;
+		r.offset = c->offset;
+		r.del_count = c->del_count;
+		r.ins_count = c->ins_count;
+		r.nr_edits = c->nr_edits;
+		if (c->move_after)
+			r.flags |= UNDO_MOVE_AFTER;
+		r.data_offset = data_offset;
+		if (c->buf) {
+			r.data_size = c->compressed_size ? c->compressed_size : c->del_count;
+			if (c->compressed_size)
+				r.flags |= UNDO_COMPRESSED;
+		}
+		data_offset += r.nr_edits * sizeof(struct change_edit) + r.data_size;
+		gbuf_add_buf(&buf, (const char *)&r, sizeof(r));
+	}
+	for (i = 0; i < changes.count; i++) {
+		struct change *c = changes.ptrs[i];
+
+		if (c->edits)
+			gbuf_add_buf(&buf, (const char *)c->edits, c->nr_edits * sizeof(struct change_edit));
+		if (c->buf)
+			gbuf_add_buf(&buf, c->buf, c->compressed_size ? c->compressed_size : c->del_count);
+	}
+	free(changes.ptrs);
+	free(parents);
+
+	dir = editor_file("undo");
+	mkdir(dir, 0700);
+	free(dir);
+
+	filename = undo_filename(b->abs_filename);
+	tmp = xsprintf("%s.tmp", filename);
+	fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd < 0) {
+		error_msg("Error creating %s: %s", tmp, strerror(errno));
+	} else if (xwrite(fd, buf.buffer, buf.len) < 0) {
+		error_msg("Error writing %s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+	} else {
+		close(fd);
+		if (rename(tmp, filename)) {
+			error_msg("Error renaming %s: %s", tmp, strerror(errno));
+			unlink(tmp);
+		}
+	}
+	free(tmp);
+	free(filename);
+	gbuf_free(&buf);
+}
+
+static bool valid_edits(const struct undo_record *r, const char *data)
+{
+	long i, del_count = 0, ins_count = 0;
+
+	for (i = 0; i < r->nr_edits; i++) {
+		struct change_edit e;
+
+		memcpy(&e, data + i * sizeof(e), sizeof(e));
+		if (e.offset < 0 || e.del_count < 0 || e.ins_count < 0)
+			return false;
+		if (!e.del_count && !e.ins_count)
+			return false;
+		if (e.del_count > r->del_count - del_count || e.ins_count > r->ins_count - ins_count)
+			return false;
+		del_count += e.del_count;
+		ins_count += e.ins_count;
+	}
+	return !r->nr_edits || (del_count == r->del_count && ins_count == r->ins_count);
+}
+
+static bool valid_record(const struct undo_record *r, long idx, long data_size, const char *data)
+{
+	long edits_size;
+
+	if (r->next < 0 || r->next >= idx)
+		return false;
+	if (r->offset < 0 || r->del_count < 0 || r->ins_count < 0)
+		return false;
+	if (r->nr_edits < 0 || r->nr_edits > data_size / (long)sizeof(struct change_edit))
+		return false;
+	edits_size = r->nr_edits * sizeof(struct change_edit);
+	if (r->data_offset < 0 || r->data_size < 0 || r->data_offset > data_size - edits_size ||
+	    r->data_size > data_size - edits_size - r->data_offset)
+		return false;
+	if (!valid_edits(r, data + r->data_offset))
+		return false;
+	if (!r->del_count)
+		return !r->data_size;
+	if (r->flags & UNDO_COMPRESSED) {
+		// checked when the change is undone or redone
+		return r->data_size > 0;
+	}
+	return r->data_size == r->del_count;
+}
+
+/*
+ * Undoing or redoing a change deletes ins_count bytes at offset and
+ * inserts del_count bytes, or does that for every edit of a chain in
+ * reverse order. Returns size of the buffer after that or -1 if an edit
+ * doesn't fit in the buffer of size bytes.
+ */
+static long reversed_size(const struct undo_record *r, const char *data, long size)
+{
+	long i;
+
+	if (r->del_count > LONG_MAX - size)
+		return -1;
+	if (!r->nr_edits) {
+		if (r->offset > size - r->ins_count)
+			return -1;
+		return size - r->ins_count + r->del_count;
+	}
+	for (i = r->nr_edits - 1; i >= 0; i--) {
+		struct change_edit e;
+
+		memcpy(&e, data + r->data_offset + i * sizeof(e), sizeof(e));
+		if (e.offset > size - e.ins_count)
+			return -1;
+		size += e.del_count - e.ins_count;
+	}
+	return size;
+}
+
+/*
+ * Changes from the current change to the change head are undone starting
+ * from the size of the buffer, other changes are redone after the change
+ * they follow. Returns false if any of them would edit past the end of
+ * the buffer.
+ */
+static bool valid_sizes(const struct undo_header *h, const struct undo_record *records, const char *data)
+{
+	long *sizes = xnew(long, h->nr_records);
+	bool ok = false;
+	long i;
+
+	for (i = 0; i < h->nr_records; i++)
+		sizes[i] = -1;
+	sizes[h->cur] = h->content_size;
+	for (i = h->cur; i; i = records[i].next) {
+		sizes[records[i].next] = reversed_size(&records[i], data, sizes[i]);
+		if (sizes[records[i].next] < 0)
+			goto out;
+	}
+	// records are in breadth-first order
+	for (i = 1; i < h->nr_records; i++) {
+		if (sizes[i] >= 0)
+			continue;
+		sizes[i] = reversed_size(&records[i], data, sizes[records[i].next]);
+		if (sizes[i] < 0)
+			goto out;
+	}
+	ok = true;
+out:
+	free(sizes);
+	return ok;
+}
+
+/*
+ * Returns tree of changes read from the undo file of the current buffer.
+ * The returned change takes place of the change head and *cur is the
+ * change which matches current contents of the buffer.
+ */
+struct change *read_undo_file(struct change **cur)
+{
+	char *filename = undo_filename(buffer->abs_filename);
+	const struct undo_record *records;
+	const struct undo_header *h;
+	struct change **changes = NULL;
+	unsigned long long hash;
+	struct change *root;
+	const char *map, *data;
+	long i, size, data_size, pos;
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		free(filename);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		goto stale;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		free(filename);
+		return NULL;
+	}
+
+	h = (const struct undo_header *)map;
+	if (memcmp(h->magic, UNDO_MAGIC, sizeof(h->magic)) || h->version != UNDO_VERSION)
+		goto invalid;
+	if (h->record_size != sizeof(struct undo_record))
+		goto invalid;
+	if (h->filename_len < 0 || h->filename_len > size)
+		goto invalid;
+	pos = sizeof(*h) + padded(h->filename_len);
+	if (pos > size)
+		goto invalid;
+	if (h->nr_records < 1 || h->nr_records > (size - pos) / (long)sizeof(*records))
+		goto invalid;
+	if (h->cur < 0 || h->cur >= h->nr_records)
+		goto invalid;
+	if (strlen(buffer->abs_filename) != h->filename_len ||
+	    memcmp(map + sizeof(*h), buffer->abs_filename, h->filename_len))
+		goto invalid;
+	hash = content_hash(buffer, &data_size);
+	if (hash != h->content_hash || data_size != h->content_size) {
+		// file has been changed by someone else
+		goto invalid;
+	}
+
+	records = (const struct undo_record *)(map + pos);
+	data = (const char *)(records + h->nr_records);
+	data_size = map + size - data;
+	for (i = 1; i < h->nr_records; i++) {
+		if (!valid_record(&records[i], i, data_size, data))
+			goto invalid;
+	}
+	if (!valid_sizes(h, records, data))
+		goto invalid;
+
+	changes = xnew(struct change *, h->nr_records);
+	for (i = 0; i < h->nr_records; i++)
+		changes[i] = alloc_change();
+	for (i = 1; i < h->nr_records; i++)
+		changes[records[i].next]->nr_prev++;
+	for (i = 0; i < h->nr_records; i++) {
+		struct change *c = changes[i];
+
+		if (c->nr_prev == 1)
+			c->prev = &c->prev1;
+		else if (c->nr_prev > 1)
+			c->prev = xnew(struct change *, c->nr_prev);
+		c->nr_prev = 0;
+	}
+	for (i = 1; i < h->nr_records; i++) {
+		const struct undo_record *r = &records[i];
+		struct change *c = changes[i];
+		struct change *next = changes[r->next];
+
+		c->next = next;
+		next->prev[next->nr_prev++] = c;
+		c->offset = r->offset;
+		c->del_count = r->del_count;
+		c->ins_count = r->ins_count;
+		c->move_after = r->flags & UNDO_MOVE_AFTER;
+		if (r->nr_edits) {
+			c->nr_edits = r->nr_edits;
+			c->edits = xmemdup(data + r->data_offset, r->nr_edits * sizeof(struct change_edit));
+		}
+		if (r->data_size) {
+			long edits_size = r->nr_edits * sizeof(struct change_edit);
+
+			c->buf = xmemdup(data + r->data_offset + edits_size, r->data_size);
+			if (r->flags & UNDO_COMPRESSED)
+				c->compressed_size = r->data_size;
+		}
+	}
+	root = changes[0];
+	*cur = changes[h->cur];
+	free(changes);
+	munmap((void *)map, size);
+	free(filename);
+	return root;
+invalid:
+	munmap((void *)map, size);
+stale:
+	unlink(filename);
+	free(filename);
+	return NULL;
+}
@@ -0,0 +1,9 @@
+#ifndef UNDO_FILE_H
+#define UNDO_FILE_H
+
+#include "buffer.h"
+
+void save_undo_file(struct buffer *b);
+struct change *read_undo_file(struct change **cur);
+
+#endif
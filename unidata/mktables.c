@@ -0,0 +1,250 @@
+/*
+ * mktables - generate unicode-tables.h from the Unicode Character Database
+ *
+ * Usage: mktables UnicodeData.txt EastAsianWidth.txt > unicode-tables.h
+ *
+ * Properties of every code point are packed into one byte and stored in
+ * a two-level table: u_stage1[u >> 8] selects a 256 byte block in
+ * u_stage2. Identical blocks are stored only once.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define NR_CODEPOINTS 0x110000
+#define BLOCK_SHIFT 8
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define NR_BLOCKS (NR_CODEPOINTS / BLOCK_SIZE)
+
+// must match unicode.c
+#define U_WIDTH_MASK		0x03
+#define U_UNPRINTABLE		0x04
+#define U_SPECIAL_WHITESPACE	0x08
+
+static const char *program;
+static char category[NR_CODEPOINTS][3];
+static unsigned char wide[NR_CODEPOINTS];
+static unsigned char props[NR_CODEPOINTS];
+static char version[64] = "unknown";
+
+static void die(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "%s: ", program);
+	fprintf(stderr, fmt, arg);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static FILE *open_file(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+
+	if (!f)
+		die("%s", strerror(errno));
+	return f;
+}
+
+// UnicodeData.txt: "CODE;NAME;CATEGORY;..." ranges as <..., First> <..., Last>
+static void read_unicode_data(const char *filename)
+{
+	FILE *f = open_file(filename);
+	char line[1024];
+	unsigned int first = 0;
+	int i;
+
+	for (i = 0; i < NR_CODEPOINTS; i++)
+		strcpy(category[i], "Cn");
+
+	while (fgets(line, sizeof(line), f)) {
+		char *name, *cat, *end;
+		unsigned int u, lo;
+
+		u = strtoul(line, &end, 16);
+		if (*end != ';' || u >= NR_CODEPOINTS)
+			die("invalid line: %s", line);
+		name = end + 1;
+		cat = strchr(name, ';');
+		if (!cat || strlen(cat) < 4 || cat[3] != ';')
+			die("invalid line: %s", line);
+		cat++;
+
+		lo = u;
+		if (strstr(name, ", First>;")) {
+			first = u;
+			continue;
+		}
+		if (strstr(name, ", Last>;"))
+			lo = first;
+		for (; lo <= u; lo++) {
+			category[lo][0] = cat[0];
+			category[lo][1] = cat[1];
+		}
+	}
+	fclose(f);
+}
+
+static void set_wide(unsigned int lo, unsigned int hi, int value)
+{
+	for (; lo <= hi; lo++)
+		wide[lo] = value;
+}
+
+// EastAsianWidth.txt: "CODE[..CODE];WIDTH # comment"
+static void read_east_asian_width(const char *filename)
+{
+	FILE *f = open_file(filename);
+	char line[1024];
+
+	// unassigned code points in these blocks default to W (UAX #11)
+	set_wide(0x3400, 0x4dbf, 1);
+	set_wide(0x4e00, 0x9fff, 1);
+	set_wide(0xf900, 0xfaff, 1);
+	set_wide(0x20000, 0x2fffd, 1);
+	set_wide(0x30000, 0x3fffd, 1);
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned int lo, hi;
+		char *end, *w;
+
+		if (line[0] == '#') {
+			if (!strncmp(line, "# EastAsianWidth-", 17)) {
+				char *dot = strstr(line, ".txt");
+				if (dot && dot - line - 17 < sizeof(version)) {
+					memcpy(version, line + 17, dot - line - 17);
+					version[dot - line - 17] = 0;
+				}
+			}
+			continue;
+		}
+		lo = strtoul(line, &end, 16);
+		if (end == line)
+			continue;
+		hi = lo;
+		if (end[0] == '.' && end[1] == '.')
+			hi = strtoul(end + 2, &end, 16);
+		while (*end == ' ')
+			end++;
+		if (*end != ';' || hi >= NR_CODEPOINTS || lo > hi)
+			die("invalid line: %s", line);
+		w = end + 1;
+		while (*w == ' ')
+			w++;
+		set_wide(lo, hi, w[0] == 'W' || w[0] == 'F');
+	}
+	fclose(f);
+}
+
+static int is_special_whitespace(unsigned int u)
+{
+	const char *c = category[u];
+
+	switch (u) {
+	case 0x0020: // ordinary space
+	case 0x1680: // Ogham space mark is visible
+	case 0x3000: // ideographic space is as wide as two spaces
+		return 0;
+	case 0x00ad: // soft hyphen
+	case 0x2800: // Braille pattern blank
+		return 1;
+	}
+	return c[0] == 'Z';
+}
+
+static int is_unprintable(unsigned int u)
+{
+	const char *c = category[u];
+
+	if (u < 0x80) {
+		// ASCII control characters are displayed as ^X
+		return 0;
+	}
+	if (u == 0x00ad) {
+		// format character but shown as space
+		return 0;
+	}
+	return c[0] == 'C' && (c[1] == 'c' || c[1] == 'f' || c[1] == 's');
+}
+
+static int char_width(unsigned int u)
+{
+	const char *c = category[u];
+
+	// combining marks are drawn over previous character
+	if (c[0] == 'M' && (c[1] == 'n' || c[1] == 'e'))
+		return 0;
+	// Hangul Jamo medial vowels and final consonants
+	if (u >= 0x1160 && u <= 0x11ff)
+		return 0;
+	return wide[u] ? 2 : 1;
+}
+
+static void print_array(const char *type, const char *name, const unsigned int *data, int count)
+{
+	int i;
+
+	printf("static const %s %s[%d] = {", type, name, count);
+	for (i = 0; i < count; i++) {
+		if (i % 16 == 0)
+			printf("\n\t");
+		else
+			printf(" ");
+		printf("%u,", data[i]);
+	}
+	printf("\n};\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static unsigned int stage1[NR_BLOCKS];
+	static unsigned int stage2[NR_CODEPOINTS];
+	int nr_stage2 = 0;
+	unsigned int u;
+	int i, j;
+
+	program = argv[0];
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s UnicodeData.txt EastAsianWidth.txt\n", program);
+		return 1;
+	}
+	read_unicode_data(argv[1]);
+	read_east_asian_width(argv[2]);
+
+	for (u = 0; u < NR_CODEPOINTS; u++) {
+		props[u] = char_width(u);
+		if (is_unprintable(u))
+			props[u] |= U_UNPRINTABLE;
+		if (is_special_whitespace(u))
+			props[u] |= U_SPECIAL_WHITESPACE;
+	}
+
+	for (i = 0; i < NR_BLOCKS; i++) {
+		const unsigned char *block = props + i * BLOCK_SIZE;
+
+		for (j = 0; j < nr_stage2; j++) {
+			int k;
+
+			for (k = 0; k < BLOCK_SIZE; k++) {
+				if (stage2[j * BLOCK_SIZE + k] != block[k])
+					break;
+			}
+			if (k == BLOCK_SIZE)
+				break;
+		}
+		if (j == nr_stage2) {
+			for (j = 0; j < BLOCK_SIZE; j++)
+				stage2[nr_stage2 * BLOCK_SIZE + j] = block[j];
+			j = nr_stage2++;
+		}
+		stage1[i] = j;
+	}
+	if (nr_stage2 > 256)
+		die("%s", "too many blocks");
+
+	printf("// Generated by unidata/mktables from Unicode %s data. Do not edit.\n\n", version);
+	printf("#define U_BLOCK_SHIFT %d\n\n", BLOCK_SHIFT);
+	print_array("unsigned char", "u_stage1", stage1, NR_BLOCKS);
+	printf("\n");
+	print_array("unsigned char", "u_stage2", stage2, nr_stage2 * BLOCK_SIZE);
+	return 0;
+}
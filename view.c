@@ -1,33 +1,30 @@
 #include "buffer.h"
 #include "uchar.h"
+#include "col-index.h"
 
 struct view *view;
 
 void update_cursor_y(void)
 {
-	struct block *blk;
-	unsigned int nl = 0;
+	long offset, nl;
 
-	list_for_each_entry(blk, &buffer->blocks, node) {
-		if (blk == view->cursor.blk) {
-			nl += count_nl(blk->data, view->cursor.offset);
-			view->cy = nl;
-			return;
-		}
-		nl += blk->nl;
-	}
-	BUG_ON(1);
+	block_start_position(&view->cursor, &offset, &nl);
+	view->cy = nl + count_nl(view->cursor.blk->data, view->cursor.offset);
 }
 
 void update_cursor_x(void)
 {
 	unsigned int tw = buffer->options.tab_width;
-	long idx = 0;
+	struct col_pos pos;
 	struct lineref lr;
-	int c = 0;
-	int w = 0;
+	long idx;
+	int c, w;
 
 	view->cx = fetch_this_line(&view->cursor, &lr);
+	col_index_seek_offset(&pos, lr.line, lr.size, false, view->cx);
+	idx = pos.offset;
+	c = pos.chars;
+	w = pos.col;
 	while (idx < view->cx) {
 		unsigned int u = lr.line[idx++];
 
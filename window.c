@@ -1,5 +1,6 @@
 #include "window.h"
 #include "file-history.h"
+#include "journal.h"
 
 PTR_ARRAY(windows);
 struct window *window;
@@ -21,6 +22,8 @@ struct view *window_add_buffer(struct buffer *b)
 	ptr_array_add(&b->views, v);
 	v->buffer = b;
 	v->window = window;
+	mark_add(b, &v->saved_cursor, 0);
+	mark_add(b, &v->sel_so, 0);
 	ptr_array_add(&window->views, v);
 	window->update_tabbar = true;
 	return v;
@@ -35,6 +38,9 @@ void view_delete(struct view *v)
 
 	v->window->update_tabbar = true;
 	ptr_array_remove(&b->views, ptr_array_idx(&b->views, v));
+	mark_remove(&v->saved_cursor);
+	mark_remove(&v->sel_so);
+	mark_remove(&v->sel_eo);
 	if (b->views.count == 0) {
 		if (b->options.file_history && b->abs_filename)
 			add_file_history(v->cy + 1, v->cx_char + 1, b->abs_filename);
@@ -85,20 +91,21 @@ void set_view(struct view *v)
 
 	if (!buffer->setup)
 		setup_buffer();
+	else if (buffer->journal_pending)
+		journal_replay();
 
 	// view.cursor can be invalid if same buffer was modified from another view
 	if (view->restore_cursor) {
 		view->cursor.blk = BLOCK(view->buffer->blocks.next);
-		block_iter_goto_offset(&view->cursor, view->saved_cursor_offset);
+		block_iter_goto_offset(&view->cursor, mark_offset(&view->saved_cursor));
 		view->restore_cursor = false;
-		view->saved_cursor_offset = 0;
 	}
 
 	// save cursor states of views sharing same buffer
 	for (i = 0; i < buffer->views.count; i++) {
 		v = buffer->views.ptrs[i];
 		if (v != view) {
-			v->saved_cursor_offset = block_iter_get_offset(&v->cursor);
+			mark_move(&v->saved_cursor, block_iter_get_offset(&v->cursor));
 			v->restore_cursor = true;
 		}
 	}
@@ -3,6 +3,9 @@
 
 #include "buffer.h"
 
+struct cell;
+struct gbuf;
+
 struct window {
 	struct ptr_array views;
 	struct frame *frame;
@@ -27,6 +30,13 @@ struct window {
 	int first_tab_idx;
 
 	bool update_tabbar;
+
+	// recently drawn lines, see screen-view.c
+	unsigned long long *rendered_hash;
+	struct gbuf *rendered_keys;
+	struct cell *rendered_cells;
+	int nr_rendered;
+	int rendered_w;
 };
 
 extern struct window *window;
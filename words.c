@@ -0,0 +1,497 @@
+#include "words.h"
+#include "buffer.h"
+#include "window.h"
+#include "change.h"
+#include "error.h"
+#include "common.h"
+
+/*
+ * Words of open buffers for completing the word before the cursor.
+ *
+ * Every word is counted once per occurrence. A buffer is scanned when a
+ * word is completed for the first time after it was opened and after that
+ * its edits update only the lines they touch (see block.c). Words whose
+ * count drops to zero are kept until there are more of them than live
+ * words so that typing a word over and over doesn't allocate anything.
+ *
+ * Words are found by name from a hash table. Completion needs them sorted
+ * and new words are appended to the end of the sorted array and merged
+ * into it on the next completion.
+ */
+
+#define MIN_WORD_LEN 2
+#define MAX_WORD_LEN 64
+
+// words this many bytes before or after the cursor are completed first
+#define NEAR_BYTES (16 * 1024)
+
+struct word {
+	long count;
+	// bytes from the cursor to the nearest occurrence if gen is near_gen
+	long distance;
+	unsigned int gen;
+	unsigned int len;
+	char str[];
+};
+
+static struct word **hash;
+static long hash_size;
+
+// nr_sorted first words are sorted
+static struct word **words;
+static long nr_words;
+static long nr_sorted;
+static long words_alloc;
+static long nr_dead;
+
+static unsigned int near_gen;
+
+static unsigned long hash_word(const char *str, long len)
+{
+	// FNV-1a
+	unsigned long h = 2166136261UL;
+	long i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+static struct word **hash_slot(const char *str, long len)
+{
+	unsigned long i = hash_word(str, len) & (hash_size - 1);
+
+	while (hash[i]) {
+		struct word *w = hash[i];
+
+		if (w->len == len && !memcmp(w->str, str, len))
+			break;
+		i = (i + 1) & (hash_size - 1);
+	}
+	return &hash[i];
+}
+
+static void rehash(long size)
+{
+	long i;
+
+	free(hash);
+	hash_size = size;
+	hash = xnew0(struct word *, hash_size);
+	for (i = 0; i < nr_words; i++)
+		*hash_slot(words[i]->str, words[i]->len) = words[i];
+}
+
+static struct word *find_word(const char *str, long len)
+{
+	if (!hash_size)
+		return NULL;
+	return *hash_slot(str, len);
+}
+
+static void add_word(const char *str, long len, int delta)
+{
+	struct word **slot, *w;
+
+	if (len < MIN_WORD_LEN || len > MAX_WORD_LEN || isdigit(*str))
+		return;
+
+	if ((nr_words + 1) * 2 > hash_size)
+		rehash(hash_size ? hash_size * 2 : 1024);
+	slot = hash_slot(str, len);
+	w = *slot;
+	if (w) {
+		if (!w->count)
+			nr_dead--;
+		w->count += delta;
+		if (w->count <= 0) {
+			w->count = 0;
+			nr_dead++;
+		}
+		return;
+	}
+	if (delta < 0)
+		return;
+
+	w = xmalloc(sizeof(*w) + len);
+	w->count = delta;
+	w->distance = 0;
+	w->gen = 0;
+	w->len = len;
+	memcpy(w->str, str, len);
+	*slot = w;
+	if (nr_words == words_alloc) {
+		words_alloc = words_alloc ? words_alloc * 2 : 1024;
+		xrenew(words, words_alloc);
+	}
+	words[nr_words++] = w;
+}
+
+void add_words(const char *buf, long size, int delta)
+{
+	long i = 0;
+
+	while (i < size) {
+		long start;
+
+		while (i < size && !is_word_byte(buf[i]))
+			i++;
+		start = i;
+		while (i < size && is_word_byte(buf[i]))
+			i++;
+		if (i > start)
+			add_word(buf + start, i - start, delta);
+	}
+}
+
+/*
+ * Adds delta to the words on lines from the cursor to len bytes after it.
+ * Called before and after every edit of the current buffer.
+ */
+void update_words(long len, int delta)
+{
+	struct block_iter bi = view->cursor;
+	struct block *blk;
+	long offset;
+
+	if (!buffer->words_indexed)
+		return;
+
+	// whole lines so that no word is cut in half
+	len += block_iter_bol(&bi);
+	blk = bi.blk;
+	offset = bi.offset;
+	while (1) {
+		const char *data = blk->data + offset;
+		long avail = blk->size - offset;
+
+		if (len < avail) {
+			// blocks contain whole lines
+			const char *nl = memchr(data + len, '\n', avail - len);
+
+			add_words(data, nl ? nl - data : avail, delta);
+			break;
+		}
+		add_words(data, avail, delta);
+		len -= avail;
+		if (blk->node.next == bi.head)
+			break;
+		blk = BLOCK(blk->node.next);
+		offset = 0;
+	}
+}
+
+static void add_buffer_words(struct buffer *b, int delta)
+{
+	struct block *blk;
+
+	list_for_each_entry(blk, &b->blocks, node)
+		add_words(blk->data, blk->size, delta);
+}
+
+void index_buffer_words(struct buffer *b)
+{
+	// the rest of the file is not in the buffer yet
+	if (b->words_indexed || buffer_incomplete(b))
+		return;
+	add_buffer_words(b, 1);
+	b->words_indexed = true;
+}
+
+void unindex_buffer_words(struct buffer *b)
+{
+	if (!b->words_indexed)
+		return;
+	add_buffer_words(b, -1);
+	b->words_indexed = false;
+}
+
+// lines were appended to the buffer after offset, see follow.c
+void add_appended_words(struct buffer *b, long offset)
+{
+	BLOCK_ITER(bi, &b->blocks);
+
+	if (!b->words_indexed)
+		return;
+	block_iter_goto_offset(&bi, offset);
+	add_words(bi.blk->data + bi.offset, bi.blk->size - bi.offset, 1);
+	while (bi.blk->node.next != &b->blocks) {
+		bi.blk = BLOCK(bi.blk->node.next);
+		add_words(bi.blk->data, bi.blk->size, 1);
+	}
+}
+
+static int word_cmp(const struct word *a, const struct word *b)
+{
+	int len = a->len < b->len ? a->len : b->len;
+	int res = memcmp(a->str, b->str, len);
+
+	if (res)
+		return res;
+	return (int)a->len - (int)b->len;
+}
+
+static int word_ptr_cmp(const void *ap, const void *bp)
+{
+	return word_cmp(*(const struct word **)ap, *(const struct word **)bp);
+}
+
+static void sort_words(void)
+{
+	struct word **merged;
+	long i, j, k;
+
+	if (nr_dead > nr_words - nr_dead && nr_dead > 1024) {
+		// free words which are not in any buffer anymore
+		long sorted = -1;
+
+		for (i = 0, j = 0; i < nr_words; i++) {
+			if (i == nr_sorted)
+				sorted = j;
+			if (words[i]->count)
+				words[j++] = words[i];
+			else
+				free(words[i]);
+		}
+		nr_sorted = sorted < 0 ? j : sorted;
+		nr_words = j;
+		nr_dead = 0;
+		rehash(hash_size);
+	}
+	if (nr_sorted == nr_words)
+		return;
+
+	qsort(words + nr_sorted, nr_words - nr_sorted, sizeof(*words), word_ptr_cmp);
+	merged = xnew(struct word *, words_alloc);
+	i = 0;
+	j = nr_sorted;
+	k = 0;
+	while (i < nr_sorted && j < nr_words) {
+		if (word_cmp(words[i], words[j]) < 0)
+			merged[k++] = words[i++];
+		else
+			merged[k++] = words[j++];
+	}
+	while (i < nr_sorted)
+		merged[k++] = words[i++];
+	while (j < nr_words)
+		merged[k++] = words[j++];
+	free(words);
+	words = merged;
+	nr_sorted = nr_words;
+}
+
+static long lower_bound(const char *prefix, long prefix_len)
+{
+	long low = 0, high = nr_sorted;
+
+	while (low < high) {
+		long mid = low + (high - low) / 2;
+		const struct word *w = words[mid];
+		long len = w->len < prefix_len ? w->len : prefix_len;
+		int res = memcmp(w->str, prefix, len);
+
+		if (res < 0 || (!res && w->len < prefix_len))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static int candidate_cmp(const void *ap, const void *bp)
+{
+	const struct word *a = *(const struct word **)ap;
+	const struct word *b = *(const struct word **)bp;
+	bool a_near = a->gen == near_gen;
+	bool b_near = b->gen == near_gen;
+
+	if (a_near != b_near)
+		return a_near ? -1 : 1;
+	if (a_near && a->distance != b->distance)
+		return a->distance < b->distance ? -1 : 1;
+	if (a->count != b->count)
+		return a->count > b->count ? -1 : 1;
+	return word_cmp(a, b);
+}
+
+/*
+ * Adds words starting with prefix but longer than it to words, nearest
+ * to the cursor first and then the most common first.
+ */
+void find_words(const char *prefix, long prefix_len, struct ptr_array *result)
+{
+	PTR_ARRAY(found);
+	long i;
+
+	sort_words();
+	for (i = lower_bound(prefix, prefix_len); i < nr_sorted; i++) {
+		struct word *w = words[i];
+
+		if (w->len < prefix_len || memcmp(w->str, prefix, prefix_len))
+			break;
+		if (w->count && w->len > prefix_len)
+			ptr_array_add(&found, w);
+	}
+	if (found.count > 1)
+		qsort(found.ptrs, found.count, sizeof(*found.ptrs), candidate_cmp);
+	for (i = 0; i < found.count; i++) {
+		struct word *w = found.ptrs[i];
+
+		ptr_array_add(result, xstrslice(w->str, 0, w->len));
+	}
+	free(found.ptrs);
+}
+
+static void mark_near_word(const char *str, long len, long distance)
+{
+	struct word *w = find_word(str, len);
+
+	if (!w || !w->count)
+		return;
+	if (w->gen != near_gen || distance < w->distance) {
+		w->gen = near_gen;
+		w->distance = distance;
+	}
+}
+
+// records distance to words starting with prefix around the cursor
+static void mark_near_words(const char *prefix, long prefix_len)
+{
+	struct block_iter bi = view->cursor;
+	long cursor = block_iter_get_offset(&bi);
+	long back = cursor < NEAR_BYTES ? cursor : NEAR_BYTES;
+	long pos;
+
+	near_gen++;
+	block_iter_back_bytes(&bi, back);
+	pos = cursor - back - block_iter_bol(&bi);
+	while (pos < cursor + NEAR_BYTES) {
+		const char *data = bi.blk->data + bi.offset;
+		long size = bi.blk->size - bi.offset;
+		long i = 0;
+
+		while (i < size) {
+			long start;
+
+			while (i < size && !is_word_byte(data[i]))
+				i++;
+			start = i;
+			while (i < size && is_word_byte(data[i]))
+				i++;
+			if (i - start > prefix_len && !memcmp(data + start, prefix, prefix_len)) {
+				long distance = pos + start - cursor;
+
+				mark_near_word(data + start, i - start, distance < 0 ? -distance : distance);
+			}
+		}
+		pos += size;
+		if (bi.blk->node.next == bi.head)
+			break;
+		bi.blk = BLOCK(bi.blk->node.next);
+		bi.offset = 0;
+	}
+}
+
+// completion which can be replaced with the next candidate
+static struct {
+	unsigned int buffer_id;
+	// buffer->cur_change after the completion was inserted
+	struct change *change;
+	// offset of the end of the prefix
+	long offset;
+	long prefix_len;
+	// length of the inserted suffix
+	long len;
+	struct ptr_array candidates;
+	// index of the inserted candidate, candidates.count for the prefix
+	long idx;
+} completion;
+
+static bool continues_completion(void)
+{
+	return completion.candidates.count &&
+		completion.buffer_id == buffer->id &&
+		completion.change == buffer->cur_change &&
+		block_iter_get_offset(&view->cursor) == completion.offset + completion.len;
+}
+
+static void insert_candidate(void)
+{
+	const char *str = "";
+	long len = 0;
+
+	if (completion.idx < completion.candidates.count) {
+		str = completion.candidates.ptrs[completion.idx];
+		str += completion.prefix_len;
+		len = strlen(str);
+	}
+	block_iter_back_bytes(&view->cursor, completion.len);
+	if (!buffer_replace_bytes(completion.len, str, len)) {
+		block_iter_skip_bytes(&view->cursor, completion.len);
+		return;
+	}
+	block_iter_skip_bytes(&view->cursor, len);
+	completion.len = len;
+	completion.change = buffer->cur_change;
+}
+
+static void index_open_buffers(void)
+{
+	int i, j;
+
+	for (i = 0; i < windows.count; i++) {
+		struct window *w = windows.ptrs[i];
+
+		for (j = 0; j < w->views.count; j++) {
+			struct view *v = w->views.ptrs[j];
+
+			index_buffer_words(v->buffer);
+		}
+	}
+}
+
+/*
+ * Completes the word before the cursor. Completing again right after that
+ * replaces the completion with the next candidate and finally with the
+ * original word.
+ */
+void complete_word(void)
+{
+	struct lineref lr;
+	long i, count;
+
+	if (buffer_incomplete(buffer)) {
+		error_msg("File is not completely loaded.");
+		return;
+	}
+	if (continues_completion()) {
+		completion.idx = (completion.idx + 1) % (completion.candidates.count + 1);
+		insert_candidate();
+		return;
+	}
+
+	ptr_array_free(&completion.candidates);
+	clear(&completion);
+
+	i = count = fetch_this_line(&view->cursor, &lr);
+	while (i > 0 && is_word_byte(lr.line[i - 1]))
+		i--;
+	if (i == count)
+		return;
+
+	index_open_buffers();
+	mark_near_words((const char *)lr.line + i, count - i);
+	find_words((const char *)lr.line + i, count - i, &completion.candidates);
+	if (!completion.candidates.count) {
+		error_msg("No completions.");
+		return;
+	}
+
+	completion.buffer_id = buffer->id;
+	completion.offset = block_iter_get_offset(&view->cursor);
+	completion.prefix_len = count - i;
+	insert_candidate();
+}
@@ -0,0 +1,17 @@
+#ifndef WORDS_H
+#define WORDS_H
+
+#include "libc.h"
+#include "ptr-array.h"
+
+struct buffer;
+
+void add_words(const char *buf, long size, int delta);
+void update_words(long len, int delta);
+void index_buffer_words(struct buffer *b);
+void unindex_buffer_words(struct buffer *b);
+void add_appended_words(struct buffer *b, long offset);
+void find_words(const char *prefix, long prefix_len, struct ptr_array *words);
+void complete_word(void);
+
+#endif